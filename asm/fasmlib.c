@@ -0,0 +1,1757 @@
+#include "fasmlib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <setjmp.h>
+
+typedef enum
+{
+    invalid_instr,
+    label,
+    addr_offset,
+    byte,
+    word,
+    string,
+    incbin,
+    fill,
+    align,
+    ldab_absolute,
+    ldab_indirect_x,
+    ldab_indirect_off,
+    ldab_post_inc,
+    ldab_post_dec,
+    ldxb_absolute,
+    ldxb_indirect_x,
+    ldxb_indirect_off,
+    stab_absolute,
+    stab_indirect_x,
+    stab_indirect_off,
+    stab_post_inc,
+    stab_post_dec,
+    stxb_absolute,
+    stxb_indirect_x,
+    stxb_indirect_off,
+    lda_immediate,
+    lda_absolute,
+    lda_indirect_x,
+    lda_indirect_off,
+    lda_post_inc,
+    lda_post_dec,
+    ldx_immediate,
+    ldx_absolute,
+    ldx_indirect_x,
+    ldx_indirect_off,
+    sta_absolute,
+    sta_indirect_x,
+    sta_indirect_off,
+    sta_post_inc,
+    sta_post_dec,
+    stx_absolute,
+    stx_indirect_x,
+    stx_indirect_off,
+    txa,
+    tax,
+    txs,
+    tsx,
+    pua,
+    pux,
+    puf,
+    poa,
+    pox,
+    pof,
+    and_immediate,
+    and_absolute,
+    and_indirect_x,
+    and_indirect_off,
+    or_immediate,
+    or_absolute,
+    or_indirect_x,
+    or_indirect_off,
+    xor_immediate,
+    xor_absolute,
+    xor_indirect_x,
+    xor_indirect_off,
+    ror_immediate,
+    ror_absolute,
+    ror_indirect_x,
+    ror_indirect_off,   
+    rol_immediate,
+    rol_absolute,
+    rol_indirect_x,
+    rol_indirect_off,     
+    lsr_immediate,
+    lsr_absolute,
+    lsr_indirect_x,
+    lsr_indirect_off, 
+    lsl_immediate,
+    lsl_absolute,
+    lsl_indirect_x,
+    lsl_indirect_off, 
+    add_immediate,
+    add_absolute,
+    add_indirect_x,
+    add_indirect_off, 
+    cmp_immediate,
+    cmp_absolute,
+    cmp_indirect_x,
+    cmp_indirect_off, 
+    sub_immediate,
+    sub_absolute,
+    sub_indirect_x,
+    sub_indirect_off,
+    adc_immediate,
+    adc_absolute,
+    adc_indirect_x,
+    adc_indirect_off,
+    sbc_immediate,
+    sbc_absolute,
+    sbc_indirect_x,
+    sbc_indirect_off,
+    mul_immediate,
+    mul_absolute,
+    mul_indirect_x,
+    mul_indirect_off,
+    div_immediate,
+    div_absolute,
+    div_indirect_x,
+    div_indirect_off,
+    mod_immediate,
+    mod_absolute,
+    mod_indirect_x,
+    mod_indirect_off,
+    jmp_absolute,
+    jmp_indirect_x,
+    jmp_indirect_off, 
+    beq_absolute,
+    beq_indirect_x,
+    beq_indirect_off,
+    bne_absolute,
+    bne_indirect_x,
+    bne_indirect_off, 
+    bgt_absolute,
+    bgt_indirect_x,
+    bgt_indirect_off, 
+    blt_absolute,
+    blt_indirect_x,
+    blt_indirect_off, 
+    jts_absolute,
+    jts_indirect_x,
+    jts_indirect_off, 
+    cas_absolute,
+    cas_indirect_x,
+    cas_indirect_off,
+    faa_absolute,
+    faa_indirect_x,
+    faa_indirect_off,
+    rts,
+    rti,
+    ina,
+    inx,
+    dea,
+    dex,
+    sei,
+    cli,
+    nop,
+    hlt,
+    lda_short,
+    ldx_short,
+    and_short,
+    or_short,
+    xor_short,
+    ror_short,
+    rol_short,
+    lsr_short,
+    lsl_short,
+    add_short,
+    cmp_short,
+    sub_short,
+    jmp_rel8,
+    beq_rel8,
+    bne_rel8,
+    bgt_rel8,
+    blt_rel8,
+    jmp_rel16,
+    beq_rel16,
+    bne_rel16,
+    bgt_rel16,
+    blt_rel16,
+} instr_enum_t;
+
+// .incbin: str is the file, param the offset and count the length
+// .fill:   count bytes of the value param
+// .align:  pads to a multiple of param, the size depends on addr
+struct instr
+{
+    instr_enum_t mnemonic; 
+    uint32_t param;
+    uint32_t count;
+    char *str;
+    unsigned int line;
+    uint32_t addr;
+    struct instr *next;
+};
+
+// set while fasm_assemble runs, errors return there instead of exiting
+static jmp_buf *fail_jmp = NULL;
+
+// the tree being built, freed by fasm_assemble after an error
+static instr_t *building = NULL;
+
+// the string of the line being parsed, not in the tree yet
+static char *parsing_str = NULL;
+
+// the error message is printed already
+static void fail(void)
+{
+    if(fail_jmp)
+    {
+        longjmp(*fail_jmp, 1);
+    }
+    exit(EXIT_FAILURE);
+}
+
+void free_instr_tree(instr_t *tree)
+{
+    instr_t *del = NULL;
+    
+    while(tree)
+    {
+        del = tree;
+        tree = tree->next;
+        
+        if(del->str)
+        {
+            free(del->str);
+        }
+        free(del);
+        del = NULL;
+    }
+}
+
+// the string of the instruction being parsed, len characters and the 0
+static void alloc_str(instr_t *instr, size_t len)
+{
+    instr->str = malloc(sizeof(char)*(len+1));
+    parsing_str = instr->str;
+}
+
+// appends to the last node added, a new tree starts when tree is NULL
+static instr_t* add_instr_tree(instr_t *tree, instr_t instr)
+{
+    static instr_t *last = NULL;
+    instr_t *new_instr = NULL;
+    
+    if(!tree)
+    {
+        tree = malloc(sizeof(*tree));
+        new_instr = tree;
+        building = tree;
+    }
+    else
+    {
+        new_instr = last;
+        new_instr->next = malloc(sizeof(*new_instr->next));
+        new_instr = new_instr->next;
+    }
+    last = new_instr;
+    
+    memcpy(new_instr, &instr, sizeof(*new_instr));
+    
+    return tree;
+}
+
+static int label_string(const char *str)
+{
+    unsigned int count = 0;
+    
+    for(;*str;++str,++count)
+    {
+        if(!isalnum(*str) && *str != '_')
+        {
+            if(*str == ':')
+            {
+                return count;
+            }
+        }
+    }
+    return 0;
+}
+
+static char* eat_whitespace(char *str)
+{
+    for(;*str && isspace(*str);++str);
+    return str;
+}
+
+static void parse_value(instr_t *instr, const char *val_str)
+{
+    char scanf_buf[50];
+    size_t n;
+    uint32_t result = 0;
+    int sscanf_result = 0;
+    
+    memset(scanf_buf,0,sizeof(scanf_buf));
+    
+    if(val_str[0] == '$')
+    {
+        sscanf_result = sscanf(val_str + 1, "%x", &result);
+    }
+    else if(val_str[0] == '%')
+    {
+        result = strtol(val_str + 1, NULL, 2);
+        sscanf_result = 1;
+    }
+    else
+    {
+        sscanf_result = sscanf(val_str, "%i", &result);
+        if(sscanf_result != 1)
+        {
+            for(n=0;isalnum(val_str[n])||val_str[n]=='_';++n)
+            {
+                scanf_buf[n]=val_str[n];
+            }
+            sscanf_result = 1;
+        }
+    }
+    
+    if(sscanf_result != 1)
+    {
+        printf("could not parse value: %s",val_str);
+        fail();
+    }
+    else
+    {
+        instr->param = result;
+        if(scanf_buf[0])
+        {
+            alloc_str(instr, strlen(scanf_buf));
+            strcpy(instr->str,scanf_buf);
+        }
+    }
+}
+
+static int try_parse_instr(char *line, const char *instr_str, instr_t *instr, instr_enum_t immediate, instr_enum_t absolute, instr_enum_t indirect_off, instr_enum_t indirect_x, instr_enum_t post_inc, instr_enum_t post_dec)
+{
+    char *p = NULL;
+    const size_t instr_str_len = strlen(instr_str);
+    
+    if(memcmp(instr_str,line,instr_str_len) == 0)
+    {
+        line += instr_str_len;
+        line = eat_whitespace(line);
+        
+        if(line[0] == '#' && immediate != invalid_instr)
+        {
+            instr->mnemonic = immediate;
+            parse_value(instr, line + 1);
+        }
+        else if(line[0] == '(')
+        {
+            p = strchr(line,',');
+            if(!p)
+            {
+                printf("could not parse line: %s",line);
+                fail();
+            }
+            else if(*(p-1) == ')' && indirect_off != invalid_instr)
+            {
+                // ($a),x+ and ($a),x- step x after the access
+                p = eat_whitespace(p + 1);
+                if(p[0] == 'x')
+                {
+                    p = eat_whitespace(p + 1);
+                }
+                if(p[0] == '+' || p[0] == '-')
+                {
+                    instr->mnemonic = p[0] == '+' ? post_inc : post_dec;
+                    if(instr->mnemonic == invalid_instr)
+                    {
+                        printf("could not parse line: %s",line);
+                        fail();
+                    }
+                }
+                else
+                {
+                    instr->mnemonic = indirect_off;
+                }
+                parse_value(instr, line + 1);
+            }
+            else if(indirect_x != invalid_instr)
+            {
+                instr->mnemonic = indirect_x;
+                parse_value(instr, line + 1);
+            }
+            else
+            {
+                printf("could not parse line: %s",line);
+                fail();
+            }
+        }
+        else if(absolute != invalid_instr)
+        {
+            instr->mnemonic = absolute;
+            parse_value(instr, line);
+        }
+        else
+        {
+            printf("could not parse line: %s",line);
+            fail();
+        }
+        
+        return 1;
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+static void str_to_lower(char *str)
+{
+    for(;*str;++str)
+    {
+        *str = tolower(*str);
+    }
+}
+
+// nested includes deeper than this are most likely a cycle
+#define MAX_INCLUDE_DEPTH 16
+
+static unsigned int include_depth = 0;
+
+// the text of the files being parsed, one per include level
+static char *sources[MAX_INCLUDE_DEPTH + 1];
+
+// the parts of the tree that are not in building yet
+static void free_parsing(void)
+{
+    unsigned int n;
+
+    free(parsing_str);
+    parsing_str = NULL;
+    for(n = 0; n <= MAX_INCLUDE_DEPTH; ++n)
+    {
+        free(sources[n]);
+        sources[n] = NULL;
+    }
+}
+
+instr_t* parse_file(instr_t *tree, const char *filename);
+
+#define MAX_PATH_LEN 400
+
+// path of the file name, relative paths start at the directory of the
+// including file, or at the working directory for a source without one
+static void include_path(char *path, const char *including, const char *name)
+{
+    const char *dir_end = NULL;
+    size_t n;
+
+    if(including)
+    {
+        dir_end = strrchr(including, '/');
+        if(strrchr(including, '\\') > dir_end)
+        {
+            dir_end = strrchr(including, '\\');
+        }
+    }
+    n = dir_end && name[0] != '/' ? (size_t)(dir_end - including + 1) : 0;
+
+    if(n + strlen(name) + 1 > MAX_PATH_LEN)
+    {
+        printf("include path too long: %s\n",name);
+        fail();
+    }
+    memcpy(path, including, n);
+    strcpy(path + n, name);
+}
+
+// tree with the lines of the file name
+static instr_t* parse_include(instr_t *tree, const char *including, char *name)
+{
+    char path[MAX_PATH_LEN];
+    size_t n;
+
+    for(n = strlen(name); n && isspace(name[n-1]); --n)
+    {
+        name[n-1] = '\0';
+    }
+    include_path(path, including, name);
+
+    if(++include_depth > MAX_INCLUDE_DEPTH)
+    {
+        printf("includes nested too deep at \"%s\"\n",path);
+        fail();
+    }
+    tree = parse_file(tree, path);
+    --include_depth;
+
+    return tree;
+}
+
+// numeric argument of a directive, no labels since the size of the
+// directive has to be known before the labels are
+static uint32_t parse_number(char *str)
+{
+    instr_t value;
+
+    memset(&value,0,sizeof(value));
+    parse_value(&value, eat_whitespace(str));
+    if(value.str)
+    {
+        printf("expected a number: %s",str);
+        fail();
+    }
+    return value.param;
+}
+
+// .incbin "file"[, offset, length], only the size is read here, the data
+// is copied in generate_image
+static void parse_incbin(instr_t *instr, const char *filename, char *args)
+{
+    char path[MAX_PATH_LEN];
+    char *end;
+    FILE *in;
+    long size;
+
+    args = eat_whitespace(args);
+    end = args[0] == '"' ? strchr(args + 1, '"') : NULL;
+    if(!end)
+    {
+        printf("expected a quoted file name: %s",args);
+        fail();
+    }
+    *end = '\0';
+    include_path(path, filename, args + 1);
+
+    in = fopen(path, "rb");
+    if(!in || fseek(in, 0, SEEK_END) != 0 || (size = ftell(in)) < 0)
+    {
+        if(in)
+        {
+            fclose(in);
+        }
+        printf("could not open file \"%s\"",path);
+        fail();
+    }
+    fclose(in);
+
+    instr->mnemonic = incbin;
+    instr->param = 0;
+    instr->count = size;
+    args = eat_whitespace(end + 1);
+    if(args[0] == ',')
+    {
+        instr->param = parse_number(args + 1);
+        if(instr->param > size)
+        {
+            printf("offset behind the end of \"%s\"\n",path);
+            fail();
+        }
+        instr->count = size - instr->param;
+        args = strchr(args + 1, ',');
+        if(args)
+        {
+            instr->count = parse_number(args + 1);
+            if(instr->count > size - instr->param)
+            {
+                printf("length behind the end of \"%s\"\n",path);
+                fail();
+            }
+        }
+    }
+
+    alloc_str(instr, strlen(path));
+    strcpy(instr->str,path);
+}
+
+#define TRY_PARSE(x) else if(try_parse_instr(line, #x, &instr, x##_immediate, x##_absolute, x##_indirect_off, x##_indirect_x, invalid_instr, invalid_instr)) { }
+#define TRY_PARSE_NO_IMMEDIATE(x) else if(try_parse_instr(line, #x, &instr, invalid_instr, x##_absolute, x##_indirect_off, x##_indirect_x, invalid_instr, invalid_instr)) { }
+#define TRY_PARSE_POST(x) else if(try_parse_instr(line, #x, &instr, x##_immediate, x##_absolute, x##_indirect_off, x##_indirect_x, x##_post_inc, x##_post_dec)) { }
+#define TRY_PARSE_POST_NO_IMMEDIATE(x) else if(try_parse_instr(line, #x, &instr, invalid_instr, x##_absolute, x##_indirect_off, x##_indirect_x, x##_post_inc, x##_post_dec)) { }
+#define TRY_PARSE_NO_PARAMS(x) else if(memcmp(#x,line,strlen(#x)) == 0) { instr.mnemonic = x; }
+
+static instr_t* parse_instr(instr_t *tree, char *line, const char *filename, unsigned int line_no)
+{
+    unsigned int pos;
+    instr_t instr;
+
+    memset(&instr,0,sizeof(instr));
+    instr.line = line_no;
+    
+    line = eat_whitespace(line);
+    
+    if(line[0] != '.')
+    {
+        str_to_lower(line);
+    }
+    
+    if(!*line || line[0] == ';')
+    {
+        return tree;
+    }
+    else if((pos = label_string(line)))
+    {
+        instr.mnemonic = label;
+        alloc_str(&instr, pos);
+        memset(instr.str, 0, sizeof(char) * (pos + 1));
+        memcpy(instr.str, line, sizeof(char) * pos);
+    }
+    else if(line[0] == '.')
+    {
+        if(memcmp("byte",line+1,sizeof("byte")-1) == 0)
+        {
+            instr.mnemonic = byte;
+            parse_value(&instr, line + 6);
+        }
+        else if(memcmp("word",line+1,sizeof("word")-1) == 0)
+        {
+            instr.mnemonic = word;
+            parse_value(&instr, line + 6);
+        }
+        else if(memcmp("incbin",line+1,sizeof("incbin")-1) == 0)
+        {
+            parse_incbin(&instr, filename, line + 7);
+        }
+        else if(memcmp("fill",line+1,sizeof("fill")-1) == 0)
+        {
+            instr.mnemonic = fill;
+            instr.count = parse_number(line + 5);
+            if(!strchr(line + 5, ','))
+            {
+                printf("expected count, value: %s",line);
+                fail();
+            }
+            instr.param = parse_number(strchr(line + 5, ',') + 1);
+        }
+        else if(memcmp("align",line+1,sizeof("align")-1) == 0)
+        {
+            instr.mnemonic = align;
+            instr.param = parse_number(line + 6);
+            if(!instr.param)
+            {
+                printf("alignment must not be 0: %s",line);
+                fail();
+            }
+        }
+        else if(memcmp("include",line+1,sizeof("include")-1) == 0)
+        {
+            return parse_include(tree, filename, eat_whitespace(line + 8));
+        }
+        else if(memcmp("string",line+1,sizeof("string")-1) == 0)
+        {
+            instr.mnemonic = string;
+            
+            pos=strlen(line+8);
+            alloc_str(&instr, pos);
+            memset(instr.str,0,sizeof(char)*(pos+1));
+            strcpy(instr.str,line+8);
+            
+            if(iscntrl(instr.str[pos-1]))
+            {
+                instr.str[pos-1] = '\0';
+            }
+        }
+        else
+        {
+            printf("could not parse line: %s",line);
+            fail();
+        }
+    }
+    else if(line[0] == '*')
+    {
+        line = eat_whitespace(line + 1);
+        if(line[0] == '=')
+        {
+            line = eat_whitespace(line + 1);
+            instr.mnemonic = addr_offset;
+            parse_value(&instr, line);
+        }
+        else
+        {
+            printf("could not parse line: %s",line);
+            fail();
+        }
+    }
+    TRY_PARSE_POST_NO_IMMEDIATE(ldab)
+    TRY_PARSE_NO_IMMEDIATE(ldxb)
+    TRY_PARSE_POST_NO_IMMEDIATE(stab)
+    TRY_PARSE_NO_IMMEDIATE(stxb)
+    TRY_PARSE_POST(lda)
+    TRY_PARSE(ldx)
+    TRY_PARSE_POST_NO_IMMEDIATE(sta)
+    TRY_PARSE_NO_IMMEDIATE(stx)
+    TRY_PARSE(and)
+    TRY_PARSE(or)
+    TRY_PARSE(xor)
+    TRY_PARSE(ror)  
+    TRY_PARSE(rol)
+    TRY_PARSE(lsr)  
+    TRY_PARSE(lsl)
+    TRY_PARSE(add)  
+    TRY_PARSE(cmp)  
+    TRY_PARSE(sub)
+    TRY_PARSE(adc)
+    TRY_PARSE(sbc)
+    TRY_PARSE(mul)
+    TRY_PARSE(div)
+    TRY_PARSE(mod)
+    TRY_PARSE_NO_IMMEDIATE(jmp)
+    TRY_PARSE_NO_IMMEDIATE(beq)
+    TRY_PARSE_NO_IMMEDIATE(bne)
+    TRY_PARSE_NO_IMMEDIATE(bgt)
+    TRY_PARSE_NO_IMMEDIATE(blt)
+    TRY_PARSE_NO_IMMEDIATE(jts)
+    TRY_PARSE_NO_IMMEDIATE(cas)
+    TRY_PARSE_NO_IMMEDIATE(faa)
+    TRY_PARSE_NO_PARAMS(txa)
+    TRY_PARSE_NO_PARAMS(tax)
+    TRY_PARSE_NO_PARAMS(txs)
+    TRY_PARSE_NO_PARAMS(tsx)
+    TRY_PARSE_NO_PARAMS(pua)
+    TRY_PARSE_NO_PARAMS(pux)
+    TRY_PARSE_NO_PARAMS(puf)
+    TRY_PARSE_NO_PARAMS(poa)
+    TRY_PARSE_NO_PARAMS(pox)     
+    TRY_PARSE_NO_PARAMS(pof)     
+    TRY_PARSE_NO_PARAMS(rts)
+    TRY_PARSE_NO_PARAMS(rti)
+    TRY_PARSE_NO_PARAMS(ina)
+    TRY_PARSE_NO_PARAMS(inx)
+    TRY_PARSE_NO_PARAMS(dea)
+    TRY_PARSE_NO_PARAMS(dex)
+    TRY_PARSE_NO_PARAMS(sei)
+    TRY_PARSE_NO_PARAMS(cli)
+    TRY_PARSE_NO_PARAMS(nop)
+    TRY_PARSE_NO_PARAMS(hlt)
+    else
+    {
+        printf("could not parse line: %s",line);
+        fail();
+    }
+    
+    tree = add_instr_tree(tree, instr);
+    parsing_str = NULL;
+    
+    return tree;
+}
+
+#undef TRY_PARSE
+#undef TRY_PARSE_NO_IMMEDIATE
+#undef TRY_PARSE_NO_PARAMS
+#undef TRY_PARSE_POST
+#undef TRY_PARSE_POST_NO_IMMEDIATE
+
+static uint32_t instr_size(instr_t instr)
+{
+#define CASE(x) case x:
+    switch(instr.mnemonic)
+    {
+        CASE(ldab_absolute)
+        CASE(ldab_indirect_x)
+        CASE(ldab_indirect_off)
+        CASE(ldab_post_inc)
+        CASE(ldab_post_dec)
+        CASE(ldxb_absolute)
+        CASE(ldxb_indirect_x)
+        CASE(ldxb_indirect_off)
+        CASE(stab_absolute)
+        CASE(stab_indirect_x)
+        CASE(stab_indirect_off)
+        CASE(stab_post_inc)
+        CASE(stab_post_dec)
+        CASE(stxb_absolute)
+        CASE(stxb_indirect_x)
+        CASE(stxb_indirect_off)
+        CASE(lda_immediate)
+        CASE(lda_absolute)
+        CASE(lda_indirect_x)
+        CASE(lda_indirect_off)
+        CASE(lda_post_inc)
+        CASE(lda_post_dec)
+        CASE(ldx_immediate)
+        CASE(ldx_absolute)
+        CASE(ldx_indirect_x)
+        CASE(ldx_indirect_off)
+        CASE(sta_absolute)
+        CASE(sta_indirect_x)
+        CASE(sta_indirect_off)
+        CASE(sta_post_inc)
+        CASE(sta_post_dec)
+        CASE(stx_absolute)
+        CASE(stx_indirect_x)
+        CASE(stx_indirect_off)
+        CASE(and_immediate)
+        CASE(and_absolute)
+        CASE(and_indirect_x)
+        CASE(and_indirect_off)
+        CASE(or_immediate)
+        CASE(or_absolute)
+        CASE(or_indirect_x)
+        CASE(or_indirect_off)
+        CASE(xor_immediate)
+        CASE(xor_absolute)
+        CASE(xor_indirect_x)
+        CASE(xor_indirect_off)
+        CASE(ror_immediate)
+        CASE(ror_absolute)
+        CASE(ror_indirect_x)
+        CASE(ror_indirect_off)   
+        CASE(rol_immediate)
+        CASE(rol_absolute)
+        CASE(rol_indirect_x)
+        CASE(rol_indirect_off)     
+        CASE(lsr_immediate)
+        CASE(lsr_absolute)
+        CASE(lsr_indirect_x)
+        CASE(lsr_indirect_off) 
+        CASE(lsl_immediate)
+        CASE(lsl_absolute)
+        CASE(lsl_indirect_x)
+        CASE(lsl_indirect_off) 
+        CASE(add_immediate)
+        CASE(add_absolute)
+        CASE(add_indirect_x)
+        CASE(add_indirect_off) 
+        CASE(cmp_immediate)
+        CASE(cmp_absolute)
+        CASE(cmp_indirect_x)
+        CASE(cmp_indirect_off) 
+        CASE(sub_immediate)
+        CASE(sub_absolute)
+        CASE(sub_indirect_x)
+        CASE(sub_indirect_off)
+        CASE(adc_immediate)
+        CASE(adc_absolute)
+        CASE(adc_indirect_x)
+        CASE(adc_indirect_off)
+        CASE(sbc_immediate)
+        CASE(sbc_absolute)
+        CASE(sbc_indirect_x)
+        CASE(sbc_indirect_off)
+        CASE(mul_immediate)
+        CASE(mul_absolute)
+        CASE(mul_indirect_x)
+        CASE(mul_indirect_off)
+        CASE(div_immediate)
+        CASE(div_absolute)
+        CASE(div_indirect_x)
+        CASE(div_indirect_off)
+        CASE(mod_immediate)
+        CASE(mod_absolute)
+        CASE(mod_indirect_x)
+        CASE(mod_indirect_off)
+        CASE(jmp_absolute)
+        CASE(jmp_indirect_x)
+        CASE(jmp_indirect_off) 
+        CASE(beq_absolute)
+        CASE(beq_indirect_x)
+        CASE(beq_indirect_off) 
+        CASE(bne_absolute)
+        CASE(bne_indirect_x)
+        CASE(bne_indirect_off) 
+        CASE(bgt_absolute)
+        CASE(bgt_indirect_x)
+        CASE(bgt_indirect_off) 
+        CASE(blt_absolute)
+        CASE(blt_indirect_x)
+        CASE(blt_indirect_off) 
+        CASE(jts_absolute)
+        CASE(jts_indirect_x)
+        CASE(jts_indirect_off)
+        CASE(cas_absolute)
+        CASE(cas_indirect_x)
+        CASE(cas_indirect_off)
+        CASE(faa_absolute)
+        CASE(faa_indirect_x)
+        CASE(faa_indirect_off)
+            return 5;
+        
+        CASE(txa)
+        CASE(tax)
+        CASE(txs)
+        CASE(tsx)
+        CASE(pua)
+        CASE(pux)
+        CASE(puf)
+        CASE(poa)
+        CASE(pox)    
+        CASE(pof)         
+        CASE(rts)
+        CASE(rti)
+        CASE(ina)
+        CASE(inx)
+        CASE(dea)
+        CASE(dex)
+        CASE(sei)
+        CASE(cli)
+        CASE(nop)
+        CASE(hlt)
+        CASE(byte)
+            return 1;
+        
+        CASE(lda_short)
+        CASE(ldx_short)
+        CASE(and_short)
+        CASE(or_short)
+        CASE(xor_short)
+        CASE(ror_short)
+        CASE(rol_short)
+        CASE(lsr_short)
+        CASE(lsl_short)
+        CASE(add_short)
+        CASE(cmp_short)
+        CASE(sub_short)
+        CASE(jmp_rel8)
+        CASE(beq_rel8)
+        CASE(bne_rel8)
+        CASE(bgt_rel8)
+        CASE(blt_rel8)
+            return 2;
+        
+        CASE(jmp_rel16)
+        CASE(beq_rel16)
+        CASE(bne_rel16)
+        CASE(bgt_rel16)
+        CASE(blt_rel16)
+            return 3;
+            
+        case word:
+            return 4;
+        
+        case label:
+            return 0;
+            
+        case string:
+            return strlen(instr.str) + 1;
+        
+        case incbin:
+        case fill:
+            return instr.count;
+        
+        case align:
+            return (instr.param - instr.addr % instr.param) % instr.param;
+        
+        default:
+            puts("instr_size: illegal mnemonic");
+            fail();
+            return 0;
+    }
+#undef CASE
+}
+
+void print_instr_tree(instr_t *tree)
+{
+    uint32_t cur_addr = 0;
+
+    printf("%-12s%-20s%-12s%s\n","address","mnemonic","param","string");
+    printf("%-12s%-20s%-12s%s\n","-------","--------","-----","------");
+    
+    for(;tree;tree = tree->next)
+    {
+        printf("%08x    ",cur_addr);
+        
+        if(tree->mnemonic == addr_offset)
+        {
+            cur_addr = tree->param;
+        }
+        else
+        {
+            cur_addr += instr_size(*tree);
+        }
+        
+#define CASE(x) case x: printf("%-20s",#x); break;
+        switch(tree->mnemonic)
+        {
+            CASE(invalid_instr)
+            CASE(label)
+            CASE(addr_offset)
+            CASE(byte)
+            CASE(word)
+            CASE(string)
+            CASE(incbin)
+            CASE(fill)
+            CASE(align)
+            CASE(ldab_absolute)
+            CASE(ldab_indirect_x)
+            CASE(ldab_indirect_off)
+            CASE(ldab_post_inc)
+            CASE(ldab_post_dec)
+            CASE(ldxb_absolute)
+            CASE(ldxb_indirect_x)
+            CASE(ldxb_indirect_off)
+            CASE(stab_absolute)
+            CASE(stab_indirect_x)
+            CASE(stab_indirect_off)
+            CASE(stab_post_inc)
+            CASE(stab_post_dec)
+            CASE(stxb_absolute)
+            CASE(stxb_indirect_x)
+            CASE(stxb_indirect_off)
+            CASE(lda_immediate)
+            CASE(lda_absolute)
+            CASE(lda_indirect_x)
+            CASE(lda_indirect_off)
+            CASE(lda_post_inc)
+            CASE(lda_post_dec)
+            CASE(ldx_immediate)
+            CASE(ldx_absolute)
+            CASE(ldx_indirect_x)
+            CASE(ldx_indirect_off)
+            CASE(sta_absolute)
+            CASE(sta_indirect_x)
+            CASE(sta_indirect_off)
+            CASE(sta_post_inc)
+            CASE(sta_post_dec)
+            CASE(stx_absolute)
+            CASE(stx_indirect_x)
+            CASE(stx_indirect_off)
+            CASE(txa)
+            CASE(tax)
+            CASE(txs)
+            CASE(tsx)
+            CASE(pua)
+            CASE(pux)
+            CASE(puf)
+            CASE(poa)
+            CASE(pox)
+            CASE(pof)
+            CASE(and_immediate)
+            CASE(and_absolute)
+            CASE(and_indirect_x)
+            CASE(and_indirect_off)
+            CASE(or_immediate)
+            CASE(or_absolute)
+            CASE(or_indirect_x)
+            CASE(or_indirect_off)
+            CASE(xor_immediate)
+            CASE(xor_absolute)
+            CASE(xor_indirect_x)
+            CASE(xor_indirect_off)
+            CASE(ror_immediate)
+            CASE(ror_absolute)
+            CASE(ror_indirect_x)
+            CASE(ror_indirect_off)   
+            CASE(rol_immediate)
+            CASE(rol_absolute)
+            CASE(rol_indirect_x)
+            CASE(rol_indirect_off)     
+            CASE(lsr_immediate)
+            CASE(lsr_absolute)
+            CASE(lsr_indirect_x)
+            CASE(lsr_indirect_off) 
+            CASE(lsl_immediate)
+            CASE(lsl_absolute)
+            CASE(lsl_indirect_x)
+            CASE(lsl_indirect_off) 
+            CASE(add_immediate)
+            CASE(add_absolute)
+            CASE(add_indirect_x)
+            CASE(add_indirect_off) 
+            CASE(cmp_immediate)
+            CASE(cmp_absolute)
+            CASE(cmp_indirect_x)
+            CASE(cmp_indirect_off) 
+            CASE(sub_immediate)
+            CASE(sub_absolute)
+            CASE(sub_indirect_x)
+            CASE(sub_indirect_off)
+            CASE(adc_immediate)
+            CASE(adc_absolute)
+            CASE(adc_indirect_x)
+            CASE(adc_indirect_off)
+            CASE(sbc_immediate)
+            CASE(sbc_absolute)
+            CASE(sbc_indirect_x)
+            CASE(sbc_indirect_off)
+            CASE(mul_immediate)
+            CASE(mul_absolute)
+            CASE(mul_indirect_x)
+            CASE(mul_indirect_off)
+            CASE(div_immediate)
+            CASE(div_absolute)
+            CASE(div_indirect_x)
+            CASE(div_indirect_off)
+            CASE(mod_immediate)
+            CASE(mod_absolute)
+            CASE(mod_indirect_x)
+            CASE(mod_indirect_off)
+            CASE(jmp_absolute)
+            CASE(jmp_indirect_x)
+            CASE(jmp_indirect_off) 
+            CASE(beq_absolute)
+            CASE(beq_indirect_x)
+            CASE(beq_indirect_off) 
+            CASE(bne_absolute)
+            CASE(bne_indirect_x)
+            CASE(bne_indirect_off) 
+            CASE(bgt_absolute)
+            CASE(bgt_indirect_x)
+            CASE(bgt_indirect_off) 
+            CASE(blt_absolute)
+            CASE(blt_indirect_x)
+            CASE(blt_indirect_off) 
+            CASE(jts_absolute)
+            CASE(jts_indirect_x)
+            CASE(jts_indirect_off) 
+            CASE(cas_absolute)
+            CASE(cas_indirect_x)
+            CASE(cas_indirect_off)
+            CASE(faa_absolute)
+            CASE(faa_indirect_x)
+            CASE(faa_indirect_off)
+            CASE(rts)
+            CASE(rti)
+            CASE(ina)
+            CASE(inx)
+            CASE(dea)
+            CASE(dex)
+            CASE(sei)
+            CASE(cli)
+            CASE(nop)
+            CASE(hlt)
+            CASE(lda_short)
+            CASE(ldx_short)
+            CASE(and_short)
+            CASE(or_short)
+            CASE(xor_short)
+            CASE(ror_short)
+            CASE(rol_short)
+            CASE(lsr_short)
+            CASE(lsl_short)
+            CASE(add_short)
+            CASE(cmp_short)
+            CASE(sub_short)
+            CASE(jmp_rel8)
+            CASE(beq_rel8)
+            CASE(bne_rel8)
+            CASE(bgt_rel8)
+            CASE(blt_rel8)
+            CASE(jmp_rel16)
+            CASE(beq_rel16)
+            CASE(bne_rel16)
+            CASE(bgt_rel16)
+            CASE(blt_rel16)
+            default: puts("print_instr_tree: illegal mnemonic");
+        }
+#undef CASE
+        if(tree->str)
+        {
+            printf("%08x    %s\n", tree->param, tree->str);
+        }
+        else
+        {
+            printf("%08x\n", tree->param);
+        }
+    }
+}
+
+void eval_labels(instr_t *tree)
+{
+    instr_t *n, *m;
+    uint32_t cur_addr = 0;
+    
+    for(n = tree;n;n = n->next)
+    {
+        if(n->mnemonic == addr_offset)
+        {
+            // *=label goes back to a label defined before, e.g. to the end
+            // of the code after an included file placed its variables
+            for(m = tree;n->str && m != n;m = m->next)
+            {
+                if(m->mnemonic == label && strcmp(n->str,m->str) == 0)
+                {
+                    n->param = m->param;
+                    break;
+                }
+            }
+            if(n->str && m == n)
+            {
+                printf("*= needs a label defined before it: %s",n->str);
+                fail();
+            }
+            cur_addr = n->param;
+        }
+        n->addr = cur_addr;
+        if(n->mnemonic != addr_offset)
+        {
+            cur_addr += instr_size(*n);
+        }
+        
+        if(n->mnemonic == label)
+        {
+            n->param = cur_addr;
+        }
+    }
+    
+    for(n = tree;n;n = n->next)
+    {
+        if(n->mnemonic != label && n->mnemonic != string && n->mnemonic != incbin && n->str)
+        {
+            for(m = tree;m;m = m->next)
+            {
+                if(m->mnemonic == label && strcmp(n->str,m->str) == 0)
+                {
+                    n->param = m->param;
+                    m = tree;
+                    break;
+                }
+            }
+            if(m != tree)
+            {
+                printf("could not evaluate label: %s",n->str);
+                fail();
+            }
+        }
+    }
+}
+
+// --compact: numeric immediates that fit a signed byte use the short
+// form. Branches start with an 8 bit offset and grow to 16 bit or back to
+// absolute until every offset fits, sizes only grow so this ends.
+void compact_instr_tree(instr_t *tree)
+{
+    instr_t *n;
+    uint32_t offset;
+    int grown;
+    
+    for(n = tree;n;n = n->next)
+    {
+#define SHORT(x) case x##_immediate: if(!n->str && n->param + 0x80 < 0x100) { n->mnemonic = x##_short; } break;
+#define REL(x) case x##_absolute: n->mnemonic = x##_rel8; break;
+        switch(n->mnemonic)
+        {
+            SHORT(lda)
+            SHORT(ldx)
+            SHORT(and)
+            SHORT(or)
+            SHORT(xor)
+            SHORT(ror)
+            SHORT(rol)
+            SHORT(lsr)
+            SHORT(lsl)
+            SHORT(add)
+            SHORT(cmp)
+            SHORT(sub)
+            REL(jmp)
+            REL(beq)
+            REL(bne)
+            REL(bgt)
+            REL(blt)
+            default: break;
+        }
+#undef SHORT
+#undef REL
+    }
+    
+    do
+    {
+        eval_labels(tree);
+        grown = 0;
+        
+        for(n = tree;n;n = n->next)
+        {
+#define GROW(x) \
+            case x##_rel8: offset = n->param - (n->addr + 2); if(offset + 0x80 >= 0x100) { n->mnemonic = x##_rel16; grown = 1; } break; \
+            case x##_rel16: offset = n->param - (n->addr + 3); if(offset + 0x8000 >= 0x10000) { n->mnemonic = x##_absolute; grown = 1; } break;
+            switch(n->mnemonic)
+            {
+                GROW(jmp)
+                GROW(beq)
+                GROW(bne)
+                GROW(bgt)
+                GROW(blt)
+                default: break;
+            }
+#undef GROW
+        }
+    }
+    while(grown);
+}
+
+// data directives are written in chunks of this size
+#define CHUNK_SIZE 0x10000
+
+// the image goes to a file or to a buffer of size bytes
+typedef struct
+{
+    FILE *file;
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t len;
+} output_t;
+
+static void out_write(output_t *out, const void *data, uint32_t n)
+{
+    if(out->file)
+    {
+        fwrite(data, 1, n, out->file);
+    }
+    else if(n > out->size - out->len)
+    {
+        printf("image larger than %u bytes\n",out->size);
+        fail();
+    }
+    else
+    {
+        memcpy(out->buf + out->len, data, n);
+    }
+    out->len += n;
+}
+
+static void out_byte(output_t *out, uint8_t value)
+{
+    out_write(out, &value, 1);
+}
+
+// count bytes of the file at offset
+static void write_incbin(output_t *out, const char *filename, uint32_t offset, uint32_t count)
+{
+    static uint8_t chunk[CHUNK_SIZE];
+    FILE *in = fopen(filename, "rb");
+    size_t n;
+
+    if(!in || fseek(in, offset, SEEK_SET) != 0)
+    {
+        if(in)
+        {
+            fclose(in);
+        }
+        printf("could not open file \"%s\"",filename);
+        fail();
+    }
+    for(;count;count -= n)
+    {
+        n = count < CHUNK_SIZE ? count : CHUNK_SIZE;
+        if(fread(chunk, 1, n, in) != n)
+        {
+            fclose(in);
+            printf("could not read file \"%s\"",filename);
+            fail();
+        }
+        out_write(out, chunk, n);
+    }
+    fclose(in);
+}
+
+// count bytes of value
+static void write_fill(output_t *out, uint8_t value, uint32_t count)
+{
+    static uint8_t chunk[CHUNK_SIZE];
+    size_t n;
+
+    memset(chunk, value, count < CHUNK_SIZE ? count : CHUNK_SIZE);
+    for(;count;count -= n)
+    {
+        n = count < CHUNK_SIZE ? count : CHUNK_SIZE;
+        out_write(out, chunk, n);
+    }
+}
+
+static void write_image(instr_t *tree, output_t *out)
+{
+    uint32_t offset;
+    
+    for(;tree;tree = tree->next)
+    {
+#define CASE(x,h) case x: out_byte(out, h); break;
+#define CASE_P(x,h) case x: out_byte(out, h); out_write(out, &tree->param, sizeof(tree->param)); break;
+#define CASE_B(x,h) case x: out_byte(out, h); out_byte(out, tree->param); break;
+#define CASE_R(x,h,n) case x: out_byte(out, h); offset = tree->param - (tree->addr + 1 + n); out_write(out, &offset, n); break;
+        switch(tree->mnemonic)
+        {
+            CASE_P(ldab_absolute,0x7f)
+            CASE_P(ldab_indirect_x,0x7e)
+            CASE_P(ldab_indirect_off,0x7d)
+            CASE_P(ldab_post_inc,0x58)
+            CASE_P(ldab_post_dec,0x59)
+            CASE_P(ldxb_absolute,0x70)
+            CASE_P(ldxb_indirect_x,0x71)
+            CASE_P(ldxb_indirect_off,0x72)
+            CASE_P(stab_absolute,0x60)
+            CASE_P(stab_indirect_x,0x61)
+            CASE_P(stab_indirect_off,0x62)
+            CASE_P(stab_post_inc,0x5a)
+            CASE_P(stab_post_dec,0x5b)
+            CASE_P(stxb_absolute,0x6D)
+            CASE_P(stxb_indirect_x,0x6E)
+            CASE_P(stxb_indirect_off,0x6F)
+            CASE_P(lda_immediate,0xaf)
+            CASE_P(lda_absolute,0xae)
+            CASE_P(lda_indirect_x,0xad)
+            CASE_P(lda_indirect_off,0xac)
+            CASE_P(lda_post_inc,0x5c)
+            CASE_P(lda_post_dec,0x5d)
+            CASE_P(ldx_immediate,0xa0)
+            CASE_P(ldx_absolute,0xa1)
+            CASE_P(ldx_indirect_x,0xa2)
+            CASE_P(ldx_indirect_off,0xa3)
+            CASE_P(sta_absolute,0x90)
+            CASE_P(sta_indirect_x,0x91)
+            CASE_P(sta_indirect_off,0x92)
+            CASE_P(sta_post_inc,0x5e)
+            CASE_P(sta_post_dec,0x5f)
+            CASE_P(stx_absolute,0x9d)
+            CASE_P(stx_indirect_x,0x9e)
+            CASE_P(stx_indirect_off,0x9f)
+            CASE_P(and_immediate,0xf0)
+            CASE_P(and_absolute,0xf1)
+            CASE_P(and_indirect_x,0xf2)
+            CASE_P(and_indirect_off,0xf3)
+            CASE_P(or_immediate,0xf4)
+            CASE_P(or_absolute,0xf5)
+            CASE_P(or_indirect_x,0xf6)
+            CASE_P(or_indirect_off,0xf7)
+            CASE_P(xor_immediate,0xf8)
+            CASE_P(xor_absolute,0xf9)
+            CASE_P(xor_indirect_x,0xfa)
+            CASE_P(xor_indirect_off,0xfb)
+            CASE_P(ror_immediate,0xfc)
+            CASE_P(ror_absolute,0xfd)
+            CASE_P(ror_indirect_x,0xfe)
+            CASE_P(ror_indirect_off,0xff)   
+            CASE_P(rol_immediate,0xe1)
+            CASE_P(rol_absolute,0xe2)
+            CASE_P(rol_indirect_x,0xe3)
+            CASE_P(rol_indirect_off,0xe4)     
+            CASE_P(lsr_immediate,0xe5)
+            CASE_P(lsr_absolute,0xe6)
+            CASE_P(lsr_indirect_x,0xe7)
+            CASE_P(lsr_indirect_off,0xe8) 
+            CASE_P(lsl_immediate,0xe9)
+            CASE_P(lsl_absolute,0xea)
+            CASE_P(lsl_indirect_x,0xeb)
+            CASE_P(lsl_indirect_off,0xec) 
+            CASE_P(add_immediate,0xc0)
+            CASE_P(add_absolute,0xc1)
+            CASE_P(add_indirect_x,0xc2)
+            CASE_P(add_indirect_off,0xc3) 
+            CASE_P(cmp_immediate,0xc4)
+            CASE_P(cmp_absolute,0xc5)
+            CASE_P(cmp_indirect_x,0xc6)
+            CASE_P(cmp_indirect_off,0xc7) 
+            CASE_P(sub_immediate,0x40)
+            CASE_P(sub_absolute,0x41)
+            CASE_P(sub_indirect_x,0x42)
+            CASE_P(sub_indirect_off,0x43)
+            CASE_P(adc_immediate,0x44)
+            CASE_P(adc_absolute,0x45)
+            CASE_P(adc_indirect_x,0x46)
+            CASE_P(adc_indirect_off,0x47)
+            CASE_P(sbc_immediate,0x48)
+            CASE_P(sbc_absolute,0x49)
+            CASE_P(sbc_indirect_x,0x4a)
+            CASE_P(sbc_indirect_off,0x4b)
+            CASE_P(mul_immediate,0x4c)
+            CASE_P(mul_absolute,0x4d)
+            CASE_P(mul_indirect_x,0x4e)
+            CASE_P(mul_indirect_off,0x4f)
+            CASE_P(div_immediate,0x50)
+            CASE_P(div_absolute,0x51)
+            CASE_P(div_indirect_x,0x52)
+            CASE_P(div_indirect_off,0x53)
+            CASE_P(mod_immediate,0x54)
+            CASE_P(mod_absolute,0x55)
+            CASE_P(mod_indirect_x,0x56)
+            CASE_P(mod_indirect_off,0x57)
+            CASE_P(jmp_absolute,0xd0)
+            CASE_P(jmp_indirect_x,0xd1)
+            CASE_P(jmp_indirect_off,0xd2) 
+            CASE_P(beq_absolute,0xdc)
+            CASE_P(beq_indirect_x,0xdd)
+            CASE_P(beq_indirect_off,0xde) 
+            CASE_P(bne_absolute,0xd3)
+            CASE_P(bne_indirect_x,0xd4)
+            CASE_P(bne_indirect_off,0xd5) 
+            CASE_P(bgt_absolute,0xd6)
+            CASE_P(bgt_indirect_x,0xd7)
+            CASE_P(bgt_indirect_off,0xd8) 
+            CASE_P(blt_absolute,0xd9)
+            CASE_P(blt_indirect_x,0xda)
+            CASE_P(blt_indirect_off,0xdb) 
+            CASE_P(jts_absolute,0xbc)
+            CASE_P(jts_indirect_x,0xbd)
+            CASE_P(jts_indirect_off,0xbe) 
+            CASE_P(cas_absolute,0x84)
+            CASE_P(cas_indirect_x,0x85)
+            CASE_P(cas_indirect_off,0x86)
+            CASE_P(faa_absolute,0x87)
+            CASE_P(faa_indirect_x,0x88)
+            CASE_P(faa_indirect_off,0x89)
+        
+            CASE(txa,0xa9)
+            CASE(tax,0xaa)
+            CASE(txs,0xb0)
+            CASE(tsx,0xb1)
+            CASE(pua,0xb2)
+            CASE(pux,0xb3)
+            CASE(puf,0xb6)
+            CASE(poa,0xb4)
+            CASE(pox,0xb5)   
+            CASE(pof,0xb7)
+            CASE(rts,0xbf)
+            CASE(rti,0xb8)
+            CASE(ina,0xc8)
+            CASE(inx,0xc9)
+            CASE(dea,0xca)
+            CASE(dex,0xcb)
+            CASE(sei,0x80)
+            CASE(cli,0x81)
+            CASE(nop,0x82)
+            CASE(hlt,0x83) 
+            
+            CASE_B(lda_short,0x20)
+            CASE_B(ldx_short,0x21)
+            CASE_B(and_short,0x22)
+            CASE_B(or_short,0x23)
+            CASE_B(xor_short,0x24)
+            CASE_B(ror_short,0x25)
+            CASE_B(rol_short,0x26)
+            CASE_B(lsr_short,0x27)
+            CASE_B(lsl_short,0x28)
+            CASE_B(add_short,0x29)
+            CASE_B(cmp_short,0x2a)
+            CASE_B(sub_short,0x2b)
+
+            CASE_R(jmp_rel8,0x30,1)
+            CASE_R(beq_rel8,0x31,1)
+            CASE_R(bne_rel8,0x32,1)
+            CASE_R(bgt_rel8,0x33,1)
+            CASE_R(blt_rel8,0x34,1)
+            CASE_R(jmp_rel16,0x38,2)
+            CASE_R(beq_rel16,0x39,2)
+            CASE_R(bne_rel16,0x3a,2)
+            CASE_R(bgt_rel16,0x3b,2)
+            CASE_R(blt_rel16,0x3c,2)
+            
+            case byte:
+                out_byte(out, tree->param);
+                break;
+            
+            case word:
+                out_write(out, &tree->param, sizeof(tree->param));
+                break;
+            
+            case string:
+                out_write(out, tree->str, strlen(tree->str)+1);
+                break;
+            
+            case incbin:
+                write_incbin(out, tree->str, tree->param, tree->count);
+                break;
+            
+            case fill:
+                write_fill(out, tree->param, tree->count);
+                break;
+            
+            case align:
+                write_fill(out, 0, instr_size(*tree));
+                break;
+            
+            case addr_offset:
+            case label:
+                break;
+            
+            default:
+                puts("generate_image: illegal mnemonic");
+                fail();
+        }
+#undef CASE
+#undef CASE_P
+#undef CASE_B
+#undef CASE_R
+    }
+}
+
+void generate_image(instr_t *tree, const char *filename)
+{
+    output_t out;
+    
+    memset(&out,0,sizeof(out));
+    out.file = fopen(filename, "wb");
+    
+    if(!out.file)
+    {
+        printf("could not create file \"%s\"",filename);
+        fail();
+    }
+    
+    write_image(tree, &out);
+    
+    fclose(out.file);
+    out.file = NULL;
+}
+
+// bitmap written by fsim --coverage, one bit per address of ram and flash
+#define COVERAGE_BYTES (0x02000000 / 8)
+
+// lists every instruction as covered (+) or not (-) with its source line
+// and the label it belongs to, followed by a summary per label. Several
+// coverage files, e.g. of runs in parallel, are merged into one report.
+void coverage_report(instr_t *tree, char *filenames[], int count)
+{
+    uint8_t *coverage = calloc(COVERAGE_BYTES, 1);
+    uint8_t *merge = malloc(COVERAGE_BYTES);
+    FILE *in;
+    instr_t *n, *cur_label = NULL;
+    unsigned int covered = 0, total = 0, label_covered = 0, label_total = 0;
+    int hit, i, j;
+
+    for(i = 0; i < count; i++)
+    {
+        in = fopen(filenames[i], "rb");
+        if(!in || fread(merge, COVERAGE_BYTES, 1, in) != 1)
+        {
+            printf("could not read coverage file \"%s\"",filenames[i]);
+            fail();
+        }
+        fclose(in);
+
+        for(j = 0; j < COVERAGE_BYTES; j++)
+        {
+            coverage[j] |= merge[j];
+        }
+    }
+    free(merge);
+
+    puts("");
+    puts("Coverage");
+    printf("%-4s%-8s%-12s%s\n"," ","line","address","label");
+
+    for(n = tree;;n = n->next)
+    {
+        if(!n || n->mnemonic == label)
+        {
+            if(cur_label && label_total)
+            {
+                printf("    %-20s %u/%u\n", cur_label->str, label_covered, label_total);
+            }
+            if(!n)
+            {
+                break;
+            }
+            cur_label = n;
+            label_covered = label_total = 0;
+            continue;
+        }
+
+        if(n->mnemonic == addr_offset || n->mnemonic == byte || n->mnemonic == word || n->mnemonic == string ||
+           n->mnemonic == incbin || n->mnemonic == fill || n->mnemonic == align)
+        {
+            continue;
+        }
+
+        hit = n->addr < 0x02000000 && coverage[n->addr / 8] & (1 << (n->addr % 8));
+        printf("%-4s%-8u%08x    ", hit ? "+" : "-", n->line, n->addr);
+        if(cur_label)
+        {
+            printf("%s+%u", cur_label->str, n->addr - cur_label->param);
+        }
+        printf("\n");
+        covered += hit;
+        label_covered += hit;
+        total++;
+        label_total++;
+    }
+
+    printf("%u/%u instructions covered\n", covered, total);
+    free(coverage);
+}
+
+// splits the text into lines like fgets would
+instr_t* parse_source(instr_t *tree, const char *source, const char *filename)
+{
+    char line[200];
+    unsigned int line_no = 0;
+    size_t n;
+    
+    do
+    {
+        for(n = 0; n < sizeof(line) - 1 && source[n] && (n == 0 || source[n-1] != '\n'); ++n);
+        memset(line,0,sizeof(line));
+        memcpy(line, source, n);
+        source += n;
+        tree = parse_instr(tree, line, filename, ++line_no);
+    }
+    while(*source);
+    
+    return tree;
+}
+
+instr_t* parse_file(instr_t *tree, const char *filename)
+{
+    FILE *in = NULL;
+    char *source = NULL;
+    long size;
+    
+    in = fopen(filename, "rb");
+    
+    if(!in || fseek(in, 0, SEEK_END) != 0 || (size = ftell(in)) < 0)
+    {
+        if(in)
+        {
+            fclose(in);
+        }
+        printf("could not open file \"%s\"",filename);
+        fail();
+    }
+    
+    // read at once, nothing stays open if a line fails
+    source = malloc(size + 1);
+    sources[include_depth] = source;
+    rewind(in);
+    source[fread(source, 1, size, in)] = '\0';
+    fclose(in);
+    in = NULL;
+    
+    tree = parse_source(tree, source, filename);
+    sources[include_depth] = NULL;
+    free(source);
+    
+    return tree;
+}
+
+long fasm_assemble(const char *filename, const char *source, int compact, uint8_t *image, uint32_t size)
+{
+    jmp_buf jmp;
+    output_t out;
+    instr_t *tree = NULL;
+    
+    memset(&out,0,sizeof(out));
+    out.buf = image;
+    out.size = size;
+    building = NULL;
+    include_depth = 0;
+    fail_jmp = &jmp;
+    
+    if(setjmp(jmp))
+    {
+        fail_jmp = NULL;
+        free_instr_tree(building);
+        building = NULL;
+        free_parsing();
+        return -1;
+    }
+    
+    tree = source ? parse_source(NULL, source, filename) : parse_file(NULL, filename);
+    
+    if(compact)
+    {
+        compact_instr_tree(tree);
+    }
+    else
+    {
+        eval_labels(tree);
+    }
+    
+    write_image(tree, &out);
+    
+    fail_jmp = NULL;
+    free_instr_tree(tree);
+    building = NULL;
+    
+    return out.len;
+}
@@ -0,0 +1,26 @@
+#ifndef FASMLIB_H
+#define FASMLIB_H
+
+#include <stdint.h>
+
+// the parsed source, one node per line
+typedef struct instr instr_t;
+
+// Assembles the source text, or the file filename if source is NULL,
+// into image. filename is the base for relative .include and .incbin
+// paths. compact selects short immediates and relative branches like
+// fasm --compact. Returns the size of the image or -1 after printing the
+// error, the process is not ended.
+long fasm_assemble(const char *filename, const char *source, int compact, uint8_t *image, uint32_t size);
+
+// the steps of fasm_assemble for the fasm tool, these exit on errors
+instr_t* parse_file(instr_t *tree, const char *filename);
+instr_t* parse_source(instr_t *tree, const char *source, const char *filename);
+void eval_labels(instr_t *tree);
+void compact_instr_tree(instr_t *tree);
+void print_instr_tree(instr_t *tree);
+void generate_image(instr_t *tree, const char *filename);
+void coverage_report(instr_t *tree, char *filenames[], int count);
+void free_instr_tree(instr_t *tree);
+
+#endif
@@ -0,0 +1,948 @@
+#include "cpu.h"
+#include "semihost.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CPU Taktfrequenz, read by the guest from $FF00 000A-$FF00 000D
+#define CPU_FREQUENCY 50000000u
+
+// the memory mapped registers, offsets from $FF00 0000
+#define IO_UART_FIFO_DEPTH  0x00
+#define IO_SSEG_1           0x01
+#define IO_SSEG_2           0x02
+#define IO_UART_STATUS      0x03
+#define IO_UART_CONTROL     0x04
+#define IO_UART_BAUDRATE    0x05
+#define IO_UART_SEND        0x06
+#define IO_UART_RECV        0x07
+#define IO_UART_RX_LEVEL    0x08
+#define IO_UART_TX_LEVEL    0x09
+#define IO_FREQUENCY        0x0A // 4 bytes
+#define IO_UART_RX_THRESHOLD 0x0E
+#define IO_UART_TX_THRESHOLD 0x0F
+#define IO_CORE_ID          0x18
+#define IO_CORE_COUNT       0x19
+#define IO_CORE_START       0x1C // 4 bytes
+#define IO_SEMIHOST         0x20 // 4 bytes
+#define IO_RETIRED          0x24 // 4 bytes
+#define IO_SNAPSHOT_MARKER  0x28
+#define IO_INTERRUPT_VECTOR 0xE0 // 4 bytes
+#define IO_INTERRUPT_FLAGS  0xF1
+
+// Setting the lazy flags. Z only keeps N, ZN is Z and N of a signed
+// result, CMP sets Z := v == a and N := v < a, STEP is INA/INX/DEA/DEX
+// with N := result < old value.
+#define SET_Z(r)        cpu->z_value = (r)
+#define SET_ZN(r)       cpu->z_value = (r); cpu->n_lhs = 0x7FFFFFFF; cpu->n_rhs = cpu->z_value
+#define SET_CMP(v, a)   cpu->z_value = (v) ^ (a); cpu->n_lhs = (v); cpu->n_rhs = (a)
+#define SET_STEP(r, o)  cpu->z_value = (r); cpu->n_lhs = (r); cpu->n_rhs = (o)
+
+#define FLAG_Z (cpu->z_value == 0)
+#define FLAG_N (cpu->n_lhs < cpu->n_rhs)
+
+// all cores use the memory of core 0
+#define RAM   (cpu->machine->ram)
+#define FLASH (cpu->machine->flash)
+
+// With more than one core the peripherals are accessed under io_lock,
+// CAS and FAA that can not use a host atomic under atomic_lock.
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t atomic_lock = PTHREAD_MUTEX_INITIALIZER;
+
+_Static_assert(offsetof(cpu_t, ram) % 4 == 0, "ram words must be aligned for the host atomics");
+
+cpu_t* cpu_create()
+{
+    cpu_t *cpu = calloc(1, sizeof(*cpu));
+
+    cpu->pc = CPU_RESET_PC;
+    cpu->sp = CPU_RESET_SP;
+    // Z = 0, N = 0
+    cpu->z_value = 1;
+    cpu->uart = uart_create();
+    cpu->intc = intc_create();
+    cpu->core_count = 1;
+    cpu->machine = cpu;
+    cpu->cores[0] = cpu;
+    return cpu;
+}
+
+cpu_t* cpu_free(cpu_t *cpu)
+{
+    int i;
+
+    for(i = 1; i < cpu->core_count; i++)
+    {
+        intc_free(cpu->cores[i]->intc);
+        free(cpu->cores[i]);
+    }
+    cpu->uart = uart_free(cpu->uart);
+    cpu->intc = intc_free(cpu->intc);
+    free(cpu);
+    return NULL;
+}
+
+void cpu_add_cores(cpu_t *cpu, int count)
+{
+    cpu_t *core;
+    int i;
+
+    for(i = cpu->core_count; i < count && i < CPU_MAX_CORES; i++)
+    {
+        // without ram and flash
+        core = calloc(1, offsetof(cpu_t, ram));
+        core->pc = CPU_RESET_PC;
+        core->sp = CPU_RESET_SP - i * CPU_CORE_STACK;
+        core->z_value = 1;
+        core->status = 1;
+        core->uart = cpu->uart;
+        core->intc = intc_create();
+        core->core_id = i;
+        core->machine = cpu;
+        cpu->cores[i] = core;
+    }
+    for(count = i, i = 0; i < count; i++)
+    {
+        cpu->cores[i]->core_count = count;
+    }
+}
+
+// starts every halted core at the Core Start Address
+static void start_cores(cpu_t *machine)
+{
+    cpu_t *core;
+    int i;
+
+    for(i = 1; i < machine->core_count; i++)
+    {
+        core = machine->cores[i];
+        if(__atomic_load_n(&core->status, __ATOMIC_ACQUIRE))
+        {
+            core->pc = machine->start_address;
+            core->sp = CPU_RESET_SP - i * CPU_CORE_STACK;
+            core->i = 0;
+            __atomic_store_n(&core->status, 0, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+uint32_t cpu_flags(cpu_t *cpu)
+{
+    return FLAG_Z | FLAG_N << 1 | cpu->i << 2 | cpu->c << 3;
+}
+
+void cpu_set_flags(cpu_t *cpu, uint32_t flags)
+{
+    cpu->z_value = !(flags & 1);
+    cpu->n_lhs = 0;
+    cpu->n_rhs = (flags >> 1) & 1;
+    cpu->i = (flags >> 2) & 1;
+    cpu->c = (flags >> 3) & 1;
+}
+
+static inline uint32_t load_word(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void store_word(uint8_t *p, uint32_t val)
+{
+    p[0] = val;
+    p[1] = val >> 8;
+    p[2] = val >> 16;
+    p[3] = val >> 24;
+}
+
+static uint8_t read_io(cpu_t *cpu, uint32_t offset)
+{
+    if(cpu->machine->io_reads)
+    {
+        cpu->machine->io_reads[offset]++;
+    }
+
+    switch(offset)
+    {
+        case IO_UART_FIFO_DEPTH:
+            return uart_read_fifo_depth(cpu->uart);
+        case IO_UART_STATUS:
+            return uart_read_status(cpu->uart);
+        case IO_UART_RECV:
+            return uart_read_recv(cpu->uart);
+        case IO_UART_RX_LEVEL:
+            return uart_read_rx_level(cpu->uart);
+        case IO_UART_TX_LEVEL:
+            return uart_read_tx_level(cpu->uart);
+        case IO_FREQUENCY:
+        case IO_FREQUENCY + 1:
+        case IO_FREQUENCY + 2:
+        case IO_FREQUENCY + 3:
+            return CPU_FREQUENCY >> (offset - IO_FREQUENCY) * 8;
+        case IO_INTERRUPT_VECTOR:
+        case IO_INTERRUPT_VECTOR + 1:
+        case IO_INTERRUPT_VECTOR + 2:
+        case IO_INTERRUPT_VECTOR + 3:
+            return cpu->interrupt_vector >> (offset - IO_INTERRUPT_VECTOR) * 8;
+        case IO_INTERRUPT_FLAGS:
+            return cpu->interrupt_flags;
+        case IO_CORE_ID:
+            return cpu->core_id;
+        case IO_CORE_COUNT:
+            return cpu->core_count;
+        case IO_RETIRED:
+        case IO_RETIRED + 1:
+        case IO_RETIRED + 2:
+        case IO_RETIRED + 3:
+            return cpu->retired >> (offset - IO_RETIRED) * 8;
+    }
+    if(offset >= INTC_VECTORS && offset <= INTC_ACTIVE)
+    {
+        return intc_read(cpu->intc, offset, cpu->interrupt_flags);
+    }
+    return 0;
+}
+
+static void write_io(cpu_t *cpu, uint32_t offset, uint8_t val)
+{
+    uint32_t shift;
+
+    if(cpu->machine->io_writes)
+    {
+        cpu->machine->io_writes[offset]++;
+    }
+
+    switch(offset)
+    {
+        case IO_UART_CONTROL:
+            uart_write_control(cpu->uart, val);
+            break;
+        case IO_UART_BAUDRATE:
+            uart_write_baudrate(cpu->uart, val);
+            break;
+        case IO_UART_SEND:
+            uart_write_send(cpu->uart, val);
+            break;
+        case IO_UART_RX_THRESHOLD:
+            uart_write_rx_threshold(cpu->uart, val);
+            break;
+        case IO_UART_TX_THRESHOLD:
+            uart_write_tx_threshold(cpu->uart, val);
+            break;
+        case IO_INTERRUPT_VECTOR:
+        case IO_INTERRUPT_VECTOR + 1:
+        case IO_INTERRUPT_VECTOR + 2:
+        case IO_INTERRUPT_VECTOR + 3:
+            shift = (offset - IO_INTERRUPT_VECTOR) * 8;
+            cpu->interrupt_vector = (cpu->interrupt_vector & ~(0xFFu << shift)) | (uint32_t)val << shift;
+            break;
+        case IO_INTERRUPT_FLAGS:
+            cpu->interrupt_flags = val;
+            break;
+        case IO_SEMIHOST:
+        case IO_SEMIHOST + 1:
+        case IO_SEMIHOST + 2:
+        case IO_SEMIHOST + 3:
+            shift = (offset - IO_SEMIHOST) * 8;
+            cpu->semihost_block = (cpu->semihost_block & ~(0xFFu << shift)) | (uint32_t)val << shift;
+            // the high byte is written last
+            if(offset == IO_SEMIHOST + 3)
+            {
+                semihost_request(cpu->machine, cpu->semihost_block);
+            }
+            break;
+        case IO_SNAPSHOT_MARKER:
+            cpu->snapshot_marker = 1;
+            break;
+        case IO_CORE_START:
+        case IO_CORE_START + 1:
+        case IO_CORE_START + 2:
+        case IO_CORE_START + 3:
+            shift = (offset - IO_CORE_START) * 8;
+            cpu->machine->start_address = (cpu->machine->start_address & ~(0xFFu << shift)) | (uint32_t)val << shift;
+            // the high byte is written last
+            if(offset == IO_CORE_START + 3)
+            {
+                start_cores(cpu->machine);
+            }
+            break;
+        default:
+            if(offset >= INTC_VECTORS && offset <= INTC_ACTIVE)
+            {
+                intc_write(cpu->intc, offset, val, &cpu->interrupt_flags);
+            }
+    }
+}
+
+// the 7-segment displays have no effect in the simulator,
+// unmapped addresses read 0 and ignore writes
+static uint8_t read_byte(cpu_t *cpu, uint32_t addr)
+{
+    if(addr < CPU_FLASH_START)
+    {
+        return RAM[addr];
+    }
+    if(addr < CPU_FLASH_END)
+    {
+        return FLASH[addr - CPU_FLASH_START];
+    }
+    if(addr >= CPU_IO_START)
+    {
+        if(cpu->core_count > 1)
+        {
+            uint8_t val;
+
+            pthread_mutex_lock(&io_lock);
+            val = read_io(cpu, addr - CPU_IO_START);
+            pthread_mutex_unlock(&io_lock);
+            return val;
+        }
+        return read_io(cpu, addr - CPU_IO_START);
+    }
+    return 0;
+}
+
+static void write_byte(cpu_t *cpu, uint32_t addr, uint8_t val)
+{
+    if(addr < CPU_FLASH_START)
+    {
+        RAM[addr] = val;
+    }
+    else if(addr < CPU_FLASH_END)
+    {
+        FLASH[addr - CPU_FLASH_START] = val;
+    }
+    else if(addr >= CPU_IO_START)
+    {
+        if(cpu->core_count > 1)
+        {
+            pthread_mutex_lock(&io_lock);
+            write_io(cpu, addr - CPU_IO_START, val);
+            pthread_mutex_unlock(&io_lock);
+        }
+        else
+        {
+            write_io(cpu, addr - CPU_IO_START, val);
+        }
+    }
+}
+
+uint32_t cpu_read(uint32_t addr, cpu_t *cpu)
+{
+    if(addr <= CPU_FLASH_START - 4)
+    {
+        return load_word(RAM + addr);
+    }
+    if(addr >= CPU_FLASH_START && addr <= CPU_FLASH_END - 4)
+    {
+        return load_word(FLASH + (addr - CPU_FLASH_START));
+    }
+    return read_byte(cpu, addr) | read_byte(cpu, addr + 1) << 8 |
+           read_byte(cpu, addr + 2) << 16 | (uint32_t)read_byte(cpu, addr + 3) << 24;
+}
+
+void cpu_write(uint32_t addr, uint32_t val, cpu_t *cpu)
+{
+    if(addr <= CPU_FLASH_START - 4)
+    {
+        store_word(RAM + addr, val);
+    }
+    else if(addr >= CPU_FLASH_START && addr <= CPU_FLASH_END - 4)
+    {
+        store_word(FLASH + (addr - CPU_FLASH_START), val);
+    }
+    else
+    {
+        write_byte(cpu, addr, val);
+        write_byte(cpu, addr + 1, val >> 8);
+        write_byte(cpu, addr + 2, val >> 16);
+        write_byte(cpu, addr + 3, val >> 24);
+    }
+}
+
+static void push(cpu_t *cpu, uint32_t val)
+{
+    cpu_write(cpu->sp, val, cpu);
+    cpu->sp -= 4;
+}
+
+static uint32_t pop(cpu_t *cpu)
+{
+    cpu->sp += 4;
+    return cpu_read(cpu->sp, cpu);
+}
+
+// instructions are only fetched from ram and flash, anything else reads
+// as the illegal opcode 0
+static uint8_t fetch_byte(cpu_t *cpu, uint32_t addr)
+{
+    return addr < CPU_FLASH_END ? read_byte(cpu, addr) : 0;
+}
+
+// the addressing modes, p is the parameter of the instruction
+static inline uint32_t ea_ix(cpu_t *cpu, uint32_t p)
+{
+    return cpu_read(p + cpu->x, cpu);
+}
+
+static inline uint32_t ea_io(cpu_t *cpu, uint32_t p)
+{
+    return cpu_read(p, cpu) + cpu->x;
+}
+
+// the ALU instructions in the order of their opcodes:
+// immediate, absolute, indirect X, indirect offset X
+#define ALU(opcode, name) \
+    case opcode:     v = p; goto name; \
+    case opcode + 1: v = cpu_read(p, cpu); goto name; \
+    case opcode + 2: v = cpu_read(ea_ix(cpu, p), cpu); goto name; \
+    case opcode + 3: v = cpu_read(ea_io(cpu, p), cpu); goto name;
+
+// the jumps: absolute, indirect X, indirect offset X
+#define JUMP(opcode, condition) \
+    case opcode:     cpu->pc = (condition) ? p : next; break; \
+    case opcode + 1: cpu->pc = (condition) ? ea_ix(cpu, p) : next; break; \
+    case opcode + 2: cpu->pc = (condition) ? ea_io(cpu, p) : next; break;
+
+// the relative jumps: a signed 8 bit (2 bytes long) or 16 bit (3 bytes
+// long) offset from the next instruction
+#define JUMP_RELATIVE(opcode, condition) \
+    case opcode:     cpu->pc = pc + 2 + ((condition) ? (int8_t)p : 0); break; \
+    case opcode + 8: cpu->pc = pc + 3 + ((condition) ? (int16_t)p : 0); break;
+
+// the uart runs on the clock of core 0 and only interrupts core 0
+static inline void clock_uart(cpu_t *cpu, uint32_t clocks)
+{
+    if(cpu->core_count == 1)
+    {
+        uart_recv_loop(cpu->uart, &cpu->interrupt_flags, clocks);
+    }
+    else if(cpu->core_id == 0)
+    {
+        pthread_mutex_lock(&io_lock);
+        uart_recv_loop(cpu->uart, &cpu->interrupt_flags, clocks);
+        pthread_mutex_unlock(&io_lock);
+    }
+}
+
+// advances the peripherals by one instruction, which counts as one clock,
+// and the second instruction of the last fused pair, and enters a pending
+// interrupt, the handler's first instruction executes in the same step.
+// With a mask set the interrupt controller picks the source and vector,
+// otherwise the General Interrupt Vector is used.
+static void poll(cpu_t *cpu)
+{
+    uint32_t vector;
+
+    // the instruction of this step counts before it reads the register
+    cpu->retired += 1 + cpu->fused_clocks;
+    clock_uart(cpu, 1 + cpu->fused_clocks);
+    cpu->fused_clocks = 0;
+
+    if(cpu->i && cpu->interrupt_flags)
+    {
+        if(!intc_enabled(cpu->intc))
+        {
+            vector = cpu->interrupt_vector;
+        }
+        else if(!intc_take(cpu->intc, &cpu->interrupt_flags, &vector))
+        {
+            return;
+        }
+        push(cpu, cpu->pc);
+        push(cpu, cpu_flags(cpu));
+        cpu->i = 0;
+        cpu->pc = vector;
+        cpu->interrupts++;
+    }
+}
+
+// n bytes of code at pc, NULL if they are not all in ram or in flash
+static inline const uint8_t* code_at(cpu_t *cpu, uint32_t pc, uint32_t n)
+{
+    if(pc <= CPU_FLASH_START - n)
+    {
+        return RAM + pc;
+    }
+    if(pc >= CPU_FLASH_START && pc <= CPU_FLASH_END - n)
+    {
+        return FLASH + (pc - CPU_FLASH_START);
+    }
+    return NULL;
+}
+
+// the host word of an aligned word in ram or flash, CAS and FAA use host
+// atomics on it, NULL if they have to take atomic_lock
+static inline uint32_t* atomic_word(cpu_t *cpu, uint32_t addr)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(addr % 4 == 0 && addr < CPU_FLASH_START)
+    {
+        return (uint32_t*)(RAM + addr);
+    }
+    if(addr % 4 == 0 && addr >= CPU_FLASH_START && addr < CPU_FLASH_END)
+    {
+        return (uint32_t*)(FLASH + (addr - CPU_FLASH_START));
+    }
+#endif
+    return NULL;
+}
+
+// if [addr] == X then [addr] := A, returns the old value of [addr]
+static uint32_t compare_and_swap(cpu_t *cpu, uint32_t addr)
+{
+    uint32_t *word = atomic_word(cpu, addr);
+    uint32_t val = cpu->x;
+
+    if(word)
+    {
+        __atomic_compare_exchange_n(word, &val, cpu->a, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        return val;
+    }
+    if(cpu->core_count > 1)
+    {
+        pthread_mutex_lock(&atomic_lock);
+    }
+    val = cpu_read(addr, cpu);
+    if(val == cpu->x)
+    {
+        cpu_write(addr, cpu->a, cpu);
+    }
+    if(cpu->core_count > 1)
+    {
+        pthread_mutex_unlock(&atomic_lock);
+    }
+    return val;
+}
+
+// [addr] := [addr] + A, returns the old value of [addr]
+static uint32_t fetch_and_add(cpu_t *cpu, uint32_t addr)
+{
+    uint32_t *word = atomic_word(cpu, addr);
+    uint32_t val;
+
+    if(word)
+    {
+        return __atomic_fetch_add(word, cpu->a, __ATOMIC_SEQ_CST);
+    }
+    if(cpu->core_count > 1)
+    {
+        pthread_mutex_lock(&atomic_lock);
+    }
+    val = cpu_read(addr, cpu);
+    cpu_write(addr, val + cpu->a, cpu);
+    if(cpu->core_count > 1)
+    {
+        pthread_mutex_unlock(&atomic_lock);
+    }
+    return val;
+}
+
+static uint8_t execute(cpu_t *cpu)
+{
+    const uint8_t *code;
+    uint8_t opcode;
+    uint32_t pc, p, v, next;
+    uint64_t wide;
+
+    // opcode and the 4 byte parameter, not every instruction uses it
+    pc = cpu->pc;
+    if((code = code_at(cpu, pc, 5)))
+    {
+        opcode = code[0];
+        p = load_word(code + 1);
+    }
+    else
+    {
+        opcode = fetch_byte(cpu, pc);
+        p = fetch_byte(cpu, pc + 1) | fetch_byte(cpu, pc + 2) << 8 |
+            fetch_byte(cpu, pc + 3) << 16 | (uint32_t)fetch_byte(cpu, pc + 4) << 24;
+    }
+    next = pc + 5;
+    cpu->pc = next;
+
+    switch(opcode)
+    {
+        // LDAB, LDXB, STAB, STXB
+        case 0x7F: v = p; goto ldab;
+        case 0x7E: v = ea_ix(cpu, p); goto ldab;
+        case 0x7D: v = ea_io(cpu, p); goto ldab;
+        ldab:
+            cpu->a = (cpu->a & ~0xFFu) | read_byte(cpu, v);
+            SET_Z(cpu->a);
+            break;
+        case 0x70: v = p; goto ldxb;
+        case 0x71: v = ea_ix(cpu, p); goto ldxb;
+        case 0x72: v = ea_io(cpu, p); goto ldxb;
+        ldxb:
+            cpu->x = (cpu->x & ~0xFFu) | read_byte(cpu, v);
+            SET_Z(cpu->x);
+            break;
+        case 0x60: write_byte(cpu, p, cpu->a); break;
+        case 0x61: write_byte(cpu, ea_ix(cpu, p), cpu->a); break;
+        case 0x62: write_byte(cpu, ea_io(cpu, p), cpu->a); break;
+        case 0x6D: write_byte(cpu, p, cpu->x); break;
+        case 0x6E: write_byte(cpu, ea_ix(cpu, p), cpu->x); break;
+        case 0x6F: write_byte(cpu, ea_io(cpu, p), cpu->x); break;
+        // post increment and decrement, X moves by the access size
+        case 0x58: v = ea_io(cpu, p); cpu->x += 1; goto ldab;
+        case 0x59: v = ea_io(cpu, p); cpu->x -= 1; goto ldab;
+        case 0x5A: write_byte(cpu, ea_io(cpu, p), cpu->a); cpu->x += 1; break;
+        case 0x5B: write_byte(cpu, ea_io(cpu, p), cpu->a); cpu->x -= 1; break;
+
+        // LDA, LDX, STA, STX
+        case 0xAF: v = p; goto lda;
+        case 0xAE: v = cpu_read(p, cpu); goto lda;
+        case 0xAD: v = cpu_read(ea_ix(cpu, p), cpu); goto lda;
+        case 0xAC: v = cpu_read(ea_io(cpu, p), cpu); goto lda;
+        lda:
+            cpu->a = v;
+            SET_Z(v);
+            break;
+        case 0xA0: v = p; goto ldx;
+        case 0xA1: v = cpu_read(p, cpu); goto ldx;
+        case 0xA2: v = cpu_read(ea_ix(cpu, p), cpu); goto ldx;
+        case 0xA3: v = cpu_read(ea_io(cpu, p), cpu); goto ldx;
+        ldx:
+            cpu->x = v;
+            SET_Z(v);
+            break;
+        case 0x90: cpu_write(p, cpu->a, cpu); break;
+        case 0x91: cpu_write(ea_ix(cpu, p), cpu->a, cpu); break;
+        case 0x92: cpu_write(ea_io(cpu, p), cpu->a, cpu); break;
+        case 0x9D: cpu_write(p, cpu->x, cpu); break;
+        case 0x9E: cpu_write(ea_ix(cpu, p), cpu->x, cpu); break;
+        case 0x9F: cpu_write(ea_io(cpu, p), cpu->x, cpu); break;
+        case 0x5C: v = cpu_read(ea_io(cpu, p), cpu); cpu->x += 4; goto lda;
+        case 0x5D: v = cpu_read(ea_io(cpu, p), cpu); cpu->x -= 4; goto lda;
+        case 0x5E: cpu_write(ea_io(cpu, p), cpu->a, cpu); cpu->x += 4; break;
+        case 0x5F: cpu_write(ea_io(cpu, p), cpu->a, cpu); cpu->x -= 4; break;
+
+        // transfers and the stack, all 1 byte long
+        case 0xA9:
+            cpu->a = cpu->x;
+            SET_Z(cpu->a);
+            cpu->pc = pc + 1;
+            break;
+        case 0xAA:
+            cpu->x = cpu->a;
+            SET_Z(cpu->x);
+            cpu->pc = pc + 1;
+            break;
+        case 0xB0:
+            cpu->sp = cpu->x;
+            SET_Z(cpu->sp);
+            cpu->pc = pc + 1;
+            break;
+        case 0xB1:
+            cpu->x = cpu->sp;
+            SET_Z(cpu->x);
+            cpu->pc = pc + 1;
+            break;
+        case 0xB2:
+            push(cpu, cpu->a);
+            SET_Z(cpu->a);
+            cpu->pc = pc + 1;
+            break;
+        case 0xB3:
+            push(cpu, cpu->x);
+            SET_Z(cpu->x);
+            cpu->pc = pc + 1;
+            break;
+        case 0xB6:
+            push(cpu, cpu_flags(cpu));
+            cpu->pc = pc + 1;
+            break;
+        case 0xB4:
+            cpu->a = pop(cpu);
+            SET_Z(cpu->a);
+            cpu->pc = pc + 1;
+            break;
+        case 0xB5:
+            cpu->x = pop(cpu);
+            SET_Z(cpu->x);
+            cpu->pc = pc + 1;
+            break;
+        case 0xB7:
+            cpu_set_flags(cpu, pop(cpu));
+            cpu->pc = pc + 1;
+            break;
+
+        // AND, OR, XOR, ROR, ROL, LSR, LSL, ADD, CMP
+        ALU(0xF0, alu_and)
+        alu_and:
+            cpu->a &= v;
+            SET_Z(cpu->a);
+            break;
+        ALU(0xF4, alu_or)
+        alu_or:
+            cpu->a |= v;
+            SET_Z(cpu->a);
+            break;
+        ALU(0xF8, alu_xor)
+        alu_xor:
+            cpu->a ^= v;
+            SET_Z(cpu->a);
+            break;
+        ALU(0xFC, alu_ror)
+        alu_ror:
+            v &= 31;
+            cpu->a = cpu->a >> v | cpu->a << ((32 - v) & 31);
+            SET_Z(cpu->a);
+            break;
+        ALU(0xE1, alu_rol)
+        alu_rol:
+            v &= 31;
+            cpu->a = cpu->a << v | cpu->a >> ((32 - v) & 31);
+            SET_Z(cpu->a);
+            break;
+        ALU(0xE5, alu_lsr)
+        alu_lsr:
+            cpu->a = v < 32 ? cpu->a >> v : 0;
+            SET_Z(cpu->a);
+            break;
+        ALU(0xE9, alu_lsl)
+        alu_lsl:
+            cpu->a = v < 32 ? cpu->a << v : 0;
+            SET_Z(cpu->a);
+            break;
+        ALU(0xC0, alu_add)
+        alu_add:
+            cpu->a += v;
+            cpu->c = cpu->a < v;
+            SET_ZN(cpu->a);
+            break;
+        ALU(0xC4, alu_cmp)
+        alu_cmp:
+            SET_CMP(v, cpu->a);
+            break;
+
+        // SUB, ADC, SBC, MUL, DIV, MOD
+        ALU(0x40, alu_sub)
+        alu_sub:
+            cpu->c = v > cpu->a;
+            cpu->a -= v;
+            SET_ZN(cpu->a);
+            break;
+        ALU(0x44, alu_adc)
+        alu_adc:
+            wide = (uint64_t)cpu->a + v + cpu->c;
+            cpu->a = (uint32_t)wide;
+            cpu->c = wide >> 32;
+            SET_ZN(cpu->a);
+            break;
+        ALU(0x48, alu_sbc)
+        alu_sbc:
+            wide = (uint64_t)cpu->a - v - cpu->c;
+            cpu->a = (uint32_t)wide;
+            cpu->c = (wide >> 32) & 1;
+            SET_ZN(cpu->a);
+            break;
+        ALU(0x4C, alu_mul)
+        alu_mul:
+            wide = (uint64_t)cpu->a * v;
+            cpu->a = (uint32_t)wide;
+            cpu->c = (wide >> 32) != 0;
+            SET_ZN(cpu->a);
+            break;
+        ALU(0x50, alu_div)
+        alu_div:
+            cpu->c = v == 0;
+            cpu->a = v ? cpu->a / v : 0xFFFFFFFFu;
+            SET_ZN(cpu->a);
+            break;
+        ALU(0x54, alu_mod)
+        alu_mod:
+            cpu->c = v == 0;
+            if(v)
+                cpu->a %= v;
+            SET_ZN(cpu->a);
+            break;
+
+        // short immediates, one byte sign extended, 2 bytes long
+        case 0x20: v = (int8_t)p; cpu->pc = pc + 2; goto lda;
+        case 0x21: v = (int8_t)p; cpu->pc = pc + 2; goto ldx;
+        case 0x22: v = (int8_t)p; cpu->pc = pc + 2; goto alu_and;
+        case 0x23: v = (int8_t)p; cpu->pc = pc + 2; goto alu_or;
+        case 0x24: v = (int8_t)p; cpu->pc = pc + 2; goto alu_xor;
+        case 0x25: v = (int8_t)p; cpu->pc = pc + 2; goto alu_ror;
+        case 0x26: v = (int8_t)p; cpu->pc = pc + 2; goto alu_rol;
+        case 0x27: v = (int8_t)p; cpu->pc = pc + 2; goto alu_lsr;
+        case 0x28: v = (int8_t)p; cpu->pc = pc + 2; goto alu_lsl;
+        case 0x29: v = (int8_t)p; cpu->pc = pc + 2; goto alu_add;
+        case 0x2A: v = (int8_t)p; cpu->pc = pc + 2; goto alu_cmp;
+        case 0x2B: v = (int8_t)p; cpu->pc = pc + 2; goto alu_sub;
+
+        // JMP, BNE, BGT, BLT, BEQ, JTS
+        JUMP(0xD0, 1)
+        JUMP(0xD3, !FLAG_Z)
+        JUMP(0xD6, !FLAG_Z && !FLAG_N)
+        JUMP(0xD9, !FLAG_Z && FLAG_N)
+        JUMP(0xDC, FLAG_Z)
+        JUMP_RELATIVE(0x30, 1)
+        JUMP_RELATIVE(0x31, FLAG_Z)
+        JUMP_RELATIVE(0x32, !FLAG_Z)
+        JUMP_RELATIVE(0x33, !FLAG_Z && !FLAG_N)
+        JUMP_RELATIVE(0x34, !FLAG_Z && FLAG_N)
+        case 0xBC: push(cpu, next); cpu->pc = p; break;
+        case 0xBD: push(cpu, next); cpu->pc = ea_ix(cpu, p); break;
+        case 0xBE: push(cpu, next); cpu->pc = ea_io(cpu, p); break;
+        case 0xBF:
+            cpu->pc = pop(cpu);
+            break;
+        // CAS: Z := [v] == X, X := [v] if they differ
+        case 0x84: v = p; goto cas;
+        case 0x85: v = ea_ix(cpu, p); goto cas;
+        case 0x86: v = ea_io(cpu, p); goto cas;
+        cas:
+            v = compare_and_swap(cpu, v);
+            SET_Z(v ^ cpu->x);
+            cpu->x = v;
+            break;
+
+        // FAA: A := [v], [v] := [v] + A
+        case 0x87: v = p; goto faa;
+        case 0x88: v = ea_ix(cpu, p); goto faa;
+        case 0x89: v = ea_io(cpu, p); goto faa;
+        faa:
+            cpu->a = fetch_and_add(cpu, v);
+            SET_ZN(cpu->a);
+            break;
+
+        case 0xB8:
+            cpu_set_flags(cpu, pop(cpu));
+            cpu->pc = pop(cpu);
+            intc_return(cpu->intc);
+            break;
+
+        // INA, INX, DEA, DEX
+        case 0xC8:
+            v = cpu->a++;
+            SET_STEP(cpu->a, v);
+            cpu->pc = pc + 1;
+            break;
+        case 0xC9:
+            v = cpu->x++;
+            SET_STEP(cpu->x, v);
+            cpu->pc = pc + 1;
+            break;
+        case 0xCA:
+            v = cpu->a--;
+            SET_STEP(cpu->a, v);
+            cpu->pc = pc + 1;
+            break;
+        case 0xCB:
+            v = cpu->x--;
+            SET_STEP(cpu->x, v);
+            cpu->pc = pc + 1;
+            break;
+
+        case 0x80:
+            cpu->i = 1;
+            cpu->pc = pc + 1;
+            break;
+        case 0x81:
+            cpu->i = 0;
+            cpu->pc = pc + 1;
+            break;
+        case 0x82:
+            cpu->pc = pc + 1;
+            break;
+        // HLT and illegal opcodes stop with the pc on the instruction
+        case 0x83:
+            cpu->status = 1;
+            cpu->pc = pc;
+            break;
+        default:
+            cpu->status = 2;
+            cpu->pc = pc;
+    }
+
+    return opcode;
+}
+
+uint8_t cpu_step(cpu_t *cpu)
+{
+    poll(cpu);
+    return execute(cpu);
+}
+
+void cpu_poll(cpu_t *cpu)
+{
+    poll(cpu);
+}
+
+uint8_t cpu_execute(cpu_t *cpu)
+{
+    return execute(cpu);
+}
+
+// The pairs are the most frequent ones in fsim --pairs profiles of the
+// OS: the compare and the test of a loop condition with the branch on
+// it, the loop counter with the jump back and the byte load that clears
+// A first. Both instructions have to be in ram or flash, and the byte
+// load only fuses with a ram or flash address, peripherals are read
+// one instruction at a time. The peripherals are polled once per pair,
+// the next poll adds the clock of the second instruction.
+int cpu_step_fused(cpu_t *cpu, uint8_t *opcode)
+{
+    const uint8_t *code;
+    uint32_t pc, p, q;
+
+    poll(cpu);
+
+    pc = cpu->pc;
+    if(!(code = code_at(cpu, pc, 10)))
+    {
+        *opcode = execute(cpu);
+        return 1;
+    }
+    p = load_word(code + 1);
+    q = load_word(code + 6);
+
+    switch(code[0] << 8 | code[5])
+    {
+        // CMP #; BNE/BEQ abs
+        case 0xC4D3:
+        case 0xC4DC:
+            SET_CMP(p, cpu->a);
+            cpu->pc = (code[5] == 0xDC) == FLAG_Z ? q : pc + 10;
+            break;
+        // AND #; BNE/BEQ abs
+        case 0xF0D3:
+        case 0xF0DC:
+            cpu->a &= p;
+            SET_Z(cpu->a);
+            cpu->pc = (code[5] == 0xDC) == FLAG_Z ? q : pc + 10;
+            break;
+        // LDA #; LDAB abs
+        case 0xAF7F:
+            if(q >= CPU_FLASH_END)
+            {
+                *opcode = execute(cpu);
+                return 1;
+            }
+            cpu->a = (p & ~0xFFu) | read_byte(cpu, q);
+            SET_Z(cpu->a);
+            cpu->pc = pc + 10;
+            break;
+        default:
+            // INX; JMP abs
+            if(code[0] == 0xC9 && code[1] == 0xD0)
+            {
+                p = cpu->x++;
+                SET_STEP(cpu->x, p);
+                cpu->pc = load_word(code + 2);
+                cpu->fused_clocks = 1;
+                *opcode = 0xD0;
+                return 2;
+            }
+            *opcode = execute(cpu);
+            return 1;
+    }
+
+    cpu->fused_clocks = 1;
+    *opcode = code[5];
+    return 2;
+}
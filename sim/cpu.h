@@ -0,0 +1,109 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "uart.h"
+#include "intc.h"
+
+#include <stdint.h>
+
+#define CPU_RAM_START   0x00000000u
+#define CPU_FLASH_START 0x01000000u
+#define CPU_FLASH_END   0x02000000u
+#define CPU_IO_START    0xFF000000u
+
+// reset values, see doc/cpu.txt
+#define CPU_RESET_PC 0x01000000u
+#define CPU_RESET_SP 0x00FFFFFCu
+
+#define CPU_MAX_CORES 16
+// the stack of core n starts n * CPU_CORE_STACK below the one of core 0
+#define CPU_CORE_STACK 0x00010000u
+
+typedef struct cpu_struct
+{
+    uint32_t a;
+    uint32_t x;
+    uint32_t pc;
+    uint32_t sp;
+
+    // Z and N are evaluated lazily, the instructions only store their
+    // operands: Z = (z_value == 0), N = (n_lhs < n_rhs). Read and write
+    // the flags with cpu_flags and cpu_set_flags.
+    uint32_t z_value;
+    uint32_t n_lhs;
+    uint32_t n_rhs;
+    uint8_t i;
+    // the carry, or the borrow of SUB and SBC
+    uint8_t c;
+
+    // 0 = running, 1 = halted, 2 = illegal opcode
+    uint8_t status;
+    uint8_t interrupt_flags;
+    uint32_t interrupt_vector;
+    // clocks of a fused instruction the peripherals have not seen yet
+    uint8_t fused_clocks;
+    // set by a write to Snapshot Marker, see fsim --save-snapshot
+    uint8_t snapshot_marker;
+    // interrupts entered by this core
+    uint64_t interrupts;
+    // instructions executed by this core, the low word is the Retired
+    // Instructions register
+    uint64_t retired;
+
+    uart_t *uart;
+    // the interrupt controller of this core, see doc/cpu.txt
+    intc_t *intc;
+
+    // Every core has its own registers, the memory and the uart belong
+    // to core 0, the machine. Only core 0 has the other cores.
+    uint8_t core_id;
+    uint8_t core_count;
+    struct cpu_struct *machine;
+    struct cpu_struct *cores[CPU_MAX_CORES];
+    uint32_t start_address;
+
+    // the Semihosting Request register
+    uint32_t semihost_block;
+
+    // accesses per register, indexed by the offset from CPU_IO_START,
+    // counted on the machine if set, see fsim --stats
+    uint64_t *io_reads;
+    uint64_t *io_writes;
+
+    // only core 0 has memory, the other cores end here
+    uint8_t ram[CPU_FLASH_START - CPU_RAM_START];
+    uint8_t flash[CPU_FLASH_END - CPU_FLASH_START];
+} cpu_t;
+
+cpu_t* cpu_create();
+// frees the other cores of a machine as well
+cpu_t* cpu_free(cpu_t *cpu);
+// adds halted cores that share the memory of core 0 until the machine has
+// count cores, they run in their own threads, see smp.h
+void cpu_add_cores(cpu_t *cpu, int count);
+
+// executes one instruction, or enters an interrupt and executes the first
+// instruction of the handler, and returns the opcode
+uint8_t cpu_step(cpu_t *cpu);
+// cpu_step in two halves for tools that look at the instruction before it
+// runs: cpu_poll clocks the peripherals and enters a pending interrupt,
+// cpu_execute executes the instruction at the pc and returns the opcode
+void cpu_poll(cpu_t *cpu);
+uint8_t cpu_execute(cpu_t *cpu);
+// Like cpu_step, but a frequent pair of instructions executes as one
+// superinstruction, without an interrupt in between. Returns the number
+// of instructions executed (1 or 2), opcode is set to the last one. A
+// pair ending in JMP starts with a 1 byte INX, all others with a 5 byte
+// instruction.
+int cpu_step_fused(cpu_t *cpu, uint8_t *opcode);
+
+// little endian word access with the side effects of the peripherals
+uint32_t cpu_read(uint32_t addr, cpu_t *cpu);
+void cpu_write(uint32_t addr, uint32_t val, cpu_t *cpu);
+
+// the flags as PUF pushes them: bit 0 = Z, 1 = N, 2 = I, 3 = C
+uint32_t cpu_flags(cpu_t *cpu);
+// sets the flags from a word like POF
+void cpu_set_flags(cpu_t *cpu, uint32_t flags);
+
+#endif
@@ -0,0 +1,258 @@
+#include "cycles.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+    M_NONE,     // no operand in memory: implied, immediate, relative
+    M_ABS,      // operand at the parameter
+    M_IX,       // operand through the pointer at parameter + X
+    M_IO,       // operand at the pointer at parameter, plus X
+    M_JIX,      // jump, only the pointer at parameter + X is read
+    M_JIO       // jump, only the pointer at parameter is read
+};
+
+typedef struct
+{
+    uint8_t len;
+    uint8_t mode;
+    uint8_t size;       // bytes of the operand
+    uint8_t count;      // operand accesses, CAS/FAA read and write
+    int8_t stack;       // words pushed (> 0) or popped (< 0)
+} timing_t;
+
+static timing_t timings[256];
+
+static void def(uint8_t op, uint8_t len, uint8_t mode, uint8_t size)
+{
+    timings[op].len = len;
+    timings[op].mode = mode;
+    timings[op].size = size;
+    timings[op].count = 1;
+}
+
+// absolute, ($a,X), ($a),X
+static void def3(uint8_t op, uint8_t size)
+{
+    def(op, 5, M_ABS, size);
+    def(op + 1, 5, M_IX, size);
+    def(op + 2, 5, M_IO, size);
+}
+
+// immediate, absolute, ($a,X), ($a),X
+static void def4(uint8_t op)
+{
+    def(op, 5, M_NONE, 0);
+    def3(op + 1, 4);
+}
+
+static void def_jump(uint8_t op)
+{
+    def(op, 5, M_NONE, 0);
+    def(op + 1, 5, M_JIX, 0);
+    def(op + 2, 5, M_JIO, 0);
+}
+
+static void def_stack(uint8_t op, int8_t words)
+{
+    def(op, 1, M_NONE, 0);
+    timings[op].stack = words;
+}
+
+static void init_timings()
+{
+    static const uint8_t alu[] = { 0xa0, 0xf0, 0xf4, 0xf8, 0xfc, 0xe1, 0xe5, 0xe9, 0xc0, 0xc4, 0x40, 0x44, 0x48, 0x4c, 0x50, 0x54 };
+    unsigned int i;
+
+    // implied instructions and unknown opcodes, which stop the cpu, only
+    // cost the fetch
+    for(i = 0; i < 256; i++)
+    {
+        def(i, 1, M_NONE, 0);
+    }
+
+    def(0x7f, 5, M_ABS, 1); def(0x7e, 5, M_IX, 1); def(0x7d, 5, M_IO, 1);
+    def3(0x70, 1);
+    def3(0x60, 1);
+    def3(0x6d, 1);
+    def(0xaf, 5, M_NONE, 0); def(0xae, 5, M_ABS, 4); def(0xad, 5, M_IX, 4); def(0xac, 5, M_IO, 4);
+    def3(0x90, 4);
+    def3(0x9d, 4);
+    for(i = 0; i < sizeof(alu); i++)
+    {
+        def4(alu[i]);
+    }
+
+    // post increment/decrement, ($a),X
+    def(0x58, 5, M_IO, 1); def(0x59, 5, M_IO, 1);
+    def(0x5a, 5, M_IO, 1); def(0x5b, 5, M_IO, 1);
+    def(0x5c, 5, M_IO, 4); def(0x5d, 5, M_IO, 4);
+    def(0x5e, 5, M_IO, 4); def(0x5f, 5, M_IO, 4);
+
+    // short immediates and relative branches
+    for(i = 0x20; i <= 0x2b; i++)
+    {
+        def(i, 2, M_NONE, 0);
+    }
+    for(i = 0; i < 5; i++)
+    {
+        def(0x30 + i, 2, M_NONE, 0);
+        def(0x38 + i, 3, M_NONE, 0);
+    }
+
+    def_jump(0xd0);
+    def_jump(0xd3);
+    def_jump(0xd6);
+    def_jump(0xd9);
+    def_jump(0xdc);
+    def_jump(0xbc);
+    timings[0xbc].stack = timings[0xbd].stack = timings[0xbe].stack = 1;
+
+    def3(0x84, 4);
+    def3(0x87, 4);
+    for(i = 0x84; i <= 0x89; i++)
+    {
+        timings[i].count = 2;
+    }
+
+    def_stack(0xb2, 1); // pua
+    def_stack(0xb3, 1); // pux
+    def_stack(0xb6, 1); // puf
+    def_stack(0xb4, -1); // poa
+    def_stack(0xb5, -1); // pox
+    def_stack(0xb7, -1); // pof
+    def_stack(0xbf, -1); // rts
+    def_stack(0xb8, -2); // rti
+}
+
+static int region(uint32_t addr)
+{
+    return addr < 0x01000000 ? CYCLES_RAM : addr < 0x02000000 ? CYCLES_FLASH : CYCLES_IO;
+}
+
+// memory contents without the side effects of cpu_read, 0 for peripherals
+static uint32_t peek(cpu_t *cpu, uint32_t addr, uint32_t n)
+{
+    uint32_t v = 0;
+
+    while(n--)
+    {
+        v <<= 8;
+        if(region(addr + n) == CYCLES_RAM)
+        {
+            v |= cpu->ram[addr + n];
+        }
+        else if(region(addr + n) == CYCLES_FLASH)
+        {
+            v |= cpu->flash[addr + n - 0x01000000];
+        }
+    }
+    return v;
+}
+
+static void access(cycles_t *cycles, uint64_t *counter, uint32_t addr, uint32_t n)
+{
+    uint32_t halfwords = ((addr + n - 1) >> 1) - (addr >> 1) + 1;
+    int r = region(addr);
+
+    counter[r] += halfwords;
+    cycles->cycles += (uint64_t)halfwords * (1 + cycles->wait[r]);
+}
+
+int cycles_init(cycles_t *cycles, const char *config)
+{
+    char *end;
+    int i;
+
+    memset(cycles, 0, sizeof(*cycles));
+    init_timings();
+
+    // flash first, the usual case only slows down flash
+    cycles->wait[CYCLES_FLASH] = strtoul(config, &end, 10);
+    for(i = 0; i < 2 && *end == ':'; i++)
+    {
+        cycles->wait[i == 0 ? CYCLES_RAM : CYCLES_IO] = strtoul(end + 1, &end, 10);
+    }
+    if(end == config || *end)
+    {
+        printf("could not parse wait states \"%s\"\n", config);
+        return 1;
+    }
+    return 0;
+}
+
+void cycles_step(cycles_t *cycles, cpu_t *cpu, int interrupt)
+{
+    uint32_t pc = cpu->pc, sp = cpu->sp, param, ptr, i;
+    const timing_t *t;
+
+    // the pc and the flags, sp is below them already
+    if(interrupt)
+    {
+        access(cycles, cycles->data, sp + 8, 4);
+        access(cycles, cycles->data, sp + 4, 4);
+    }
+
+    t = &timings[peek(cpu, pc, 1)];
+    cycles->instructions++;
+    cycles->cycles++;
+    access(cycles, cycles->fetch, pc, t->len);
+    param = peek(cpu, pc + 1, 4);
+
+    switch(t->mode)
+    {
+        case M_ABS:
+            for(i = 0; i < t->count; i++)
+            {
+                access(cycles, cycles->data, param, t->size);
+            }
+            break;
+        case M_IX:
+        case M_IO:
+            ptr = t->mode == M_IX ? param + cpu->x : param;
+            access(cycles, cycles->data, ptr, 4);
+            // a pointer in a peripheral is not followed
+            if(region(ptr) != CYCLES_IO)
+            {
+                ptr = peek(cpu, ptr, 4) + (t->mode == M_IO ? cpu->x : 0);
+                for(i = 0; i < t->count; i++)
+                {
+                    access(cycles, cycles->data, ptr, t->size);
+                }
+            }
+            break;
+        case M_JIX:
+            access(cycles, cycles->data, param + cpu->x, 4);
+            break;
+        case M_JIO:
+            access(cycles, cycles->data, param, 4);
+            break;
+        default:
+            break;
+    }
+
+    for(i = 0; (int)i < t->stack; i++)
+    {
+        access(cycles, cycles->data, sp - 4 * i, 4);
+    }
+    for(i = 0; (int)i < -t->stack; i++)
+    {
+        access(cycles, cycles->data, sp + 4 * (i + 1), 4);
+    }
+}
+
+void cycles_report(cycles_t *cycles)
+{
+    puts("Cycles:");
+    printf("wait states  = flash %u, ram %u, io %u\n", cycles->wait[CYCLES_FLASH], cycles->wait[CYCLES_RAM], cycles->wait[CYCLES_IO]);
+    printf("instructions = %llu\n", (unsigned long long)cycles->instructions);
+    printf("cycles       = %llu (%.2f per instruction)\n", (unsigned long long)cycles->cycles,
+           cycles->instructions ? (double)cycles->cycles / cycles->instructions : 0);
+    printf("fetch        = ram %llu, flash %llu, io %llu halfwords\n", (unsigned long long)cycles->fetch[CYCLES_RAM],
+           (unsigned long long)cycles->fetch[CYCLES_FLASH], (unsigned long long)cycles->fetch[CYCLES_IO]);
+    printf("data         = ram %llu, flash %llu, io %llu halfwords\n", (unsigned long long)cycles->data[CYCLES_RAM],
+           (unsigned long long)cycles->data[CYCLES_FLASH], (unsigned long long)cycles->data[CYCLES_IO]);
+    puts("");
+}
@@ -0,0 +1,34 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+// RAM and flash on the Nexys2 are 16 bit wide, every started halfword
+// of an access costs one cycle plus the wait states of its region
+enum { CYCLES_RAM, CYCLES_FLASH, CYCLES_IO, CYCLES_REGIONS };
+
+typedef struct
+{
+    uint32_t wait[CYCLES_REGIONS];
+    uint64_t fetch[CYCLES_REGIONS];     // halfwords of instructions
+    uint64_t data[CYCLES_REGIONS];      // halfwords of operands, pointers and stack
+    uint64_t instructions;
+    uint64_t cycles;
+} cycles_t;
+
+// config is "<flash wait states>[:<ram wait states>[:<io wait states>]]",
+// missing values are 0. Returns 0 on success.
+int cycles_init(cycles_t *cycles, const char *config);
+
+// Counts the instruction cpu_execute executes next, call it between
+// cpu_poll and cpu_execute. The accesses are decoded from the state
+// before the instruction: one cycle to execute plus the fetch, the
+// operand (through pointers if indirect) and the stack words. If
+// cpu_poll entered an interrupt, its two pushed words count as well.
+void cycles_step(cycles_t *cycles, cpu_t *cpu, int interrupt);
+
+void cycles_report(cycles_t *cycles);
+
+#endif
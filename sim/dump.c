@@ -0,0 +1,69 @@
+#include "dump.h"
+
+#include <stdio.h>
+
+void dump_flash_head(cpu_t *cpu, uint32_t bytes)
+{
+    uint32_t i;
+
+    printf("First %u bytes of flash:", bytes);
+    for(i = 0;i < bytes; i++) {
+        if (i % 16 == 0)
+        {
+            printf("\n%08x:", i + 0x01000000);
+        }
+        if (i % 2 == 0)
+        {
+            printf(" ");
+        }
+        printf("%02x", cpu->flash[i]);
+    }
+    printf("\n\n");
+}
+
+void dump_stack(cpu_t *cpu, uint8_t words)
+{
+    uint32_t sp = cpu->sp;
+    
+    puts("Stack Dump");
+    
+    for(;sp != 0x00FFFFFC && sp - cpu->sp < words * 4u; sp += 4)
+    {
+        printf("%08x = 0x%08x\n", sp+4, cpu_read(sp+4,cpu));
+    }
+}
+
+void dump_exit(cpu_t *cpu, uint8_t opcode)
+{
+    switch (cpu->status)
+    {
+        case 2:
+            printf("Illegal opcode \"%02x\"\n", opcode);
+            break;
+        case 1:
+            puts("");
+            puts("####################");
+            puts("#        ##        #");
+            puts("#### Halted CPU ####");
+            puts("#        ##        #");
+            puts("####################");
+            puts("");
+            break;
+        default:
+            printf("Unknown exit status %d", cpu->status);
+    }
+
+    puts("Register Dump:");
+    printf("A  = %08x\n", cpu->a);
+    printf("X  = %08x\n", cpu->x);
+    printf("PC = %08x\n", cpu->pc);
+    printf("SP = %08x\n", cpu->sp);
+    printf("z  = %01d\n", cpu_flags(cpu) & 1);
+    printf("n  = %01d\n", (cpu_flags(cpu) >> 1) & 1);
+    printf("i  = %01d\n", cpu->i);
+    printf("c  = %01d\n", cpu->c);
+    printf("if = %02x\n", cpu->interrupt_flags);
+    printf("iv = %08x\n", cpu->interrupt_vector);
+    puts("");
+    dump_stack(cpu, 10);
+}
@@ -0,0 +1,21 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+// the console reports of fsim and the native runner, both print the
+// same so their output can be compared
+
+// the first bytes of flash, 16 per line
+void dump_flash_head(cpu_t *cpu, uint32_t bytes);
+
+// words from the top of the stack
+void dump_stack(cpu_t *cpu, uint8_t words);
+
+// why the cpu stopped, opcode is the last one cpu_step returned, then
+// the registers and the stack
+void dump_exit(cpu_t *cpu, uint8_t opcode);
+
+#endif
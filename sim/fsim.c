@@ -1,36 +1,345 @@
 #include "cpu.h"
+#include "smp.h"
+#include "snapshot.h"
+#include "semihost.h"
+#include "pace.h"
+#include "watch.h"
+#include "fuzz.h"
+#include "stats.h"
+#include "cycles.h"
+#include "dump.h"
+#include "fasmlib.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
 
-void dump_stack(cpu_t *cpu, uint8_t words)
+typedef struct
 {
-    uint32_t sp = cpu->sp;
-    
-    puts("Stack Dump");
-    
-    for(;sp != 0x00FFFFFC && sp - cpu->sp < 40; sp += 4)
+    uint8_t first;
+    uint8_t second;
+    uint64_t count;
+} opcode_pair_t;
+
+static uint64_t opcode_pairs[256][256];
+
+int compare_opcode_pairs(const void *a, const void *b)
+{
+    const opcode_pair_t *pa = a, *pb = b;
+
+    if (pa->count == pb->count)
+    {
+        return 0;
+    }
+    return pa->count < pb->count ? 1 : -1;
+}
+
+// writes all adjacent opcode pairs seen, most frequent first,
+// used to pick candidates for fused handlers
+void dump_opcode_pairs(const char *filename)
+{
+    opcode_pair_t *pairs = malloc(sizeof(*pairs) * 256 * 256);
+    size_t n = 0, i;
+    int first, second;
+    FILE *file = fopen(filename, "w");
+
+    if(!file)
+    {
+        printf("could not open pairs file \"%s\"", filename);
+        free(pairs);
+        return;
+    }
+
+    for (first = 0; first < 256; first++)
+    {
+        for (second = 0; second < 256; second++)
+        {
+            if (opcode_pairs[first][second])
+            {
+                pairs[n].first = first;
+                pairs[n].second = second;
+                pairs[n].count = opcode_pairs[first][second];
+                n++;
+            }
+        }
+    }
+
+    qsort(pairs, n, sizeof(*pairs), compare_opcode_pairs);
+
+    fprintf(file, "first second count\n");
+    for (i = 0; i < n; i++)
+    {
+        fprintf(file, "%02x    %02x     %llu\n", pairs[i].first, pairs[i].second, (unsigned long long)pairs[i].count);
+    }
+
+    fclose(file);
+    free(pairs);
+    printf("Dumped opcode pairs to \"%s\"\n", filename);
+}
+
+// one bit per address of ram and flash, bit (addr & 7) of byte addr / 8,
+// addresses above flash wrap around instead of costing a compare
+#define COVERAGE_BYTES (0x02000000 / 8)
+#define COVERAGE_MARK(pc) (coverage[((pc) >> 3) & (COVERAGE_BYTES - 1)] |= 1 << ((pc) & 7))
+
+static uint8_t coverage[COVERAGE_BYTES];
+
+// an existing file is merged, so many runs add up to one bitmap
+void load_coverage(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+
+    if (file)
+    {
+        if (fread(coverage, sizeof(coverage), 1, file) != 1)
+        {
+            printf("ignoring incomplete coverage file \"%s\"\n", filename);
+            memset(coverage, 0, sizeof(coverage));
+        }
+        fclose(file);
+    }
+}
+
+void save_coverage(const char *filename)
+{
+    FILE *file = fopen(filename, "wb");
+
+    if(!file)
+    {
+        printf("could not open coverage file \"%s\"", filename);
+        return;
+    }
+    fwrite(coverage, sizeof(coverage), 1, file);
+    fclose(file);
+    printf("Saved coverage to \"%s\"\n", filename);
+}
+
+// comma separated list of <hex address>[:<hex length>], length defaults to a word
+int add_watchpoints(cpu_t *cpu, char *list, int access)
+{
+    char *range, *len;
+    uint32_t start;
+
+    for (range = strtok(list, ","); range; range = strtok(NULL, ","))
+    {
+        start = strtoul(range, &len, 16);
+        if (watch_add(cpu, start, start + (*len == ':' ? strtoul(len + 1, NULL, 16) : 4), access) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// prints the hits of the instruction at pc and the stack
+static void report_watch(cpu_t *cpu, uint32_t pc)
+{
+    if (watch_pending && watch_step_done(cpu, pc))
+    {
+        watch_suspend();
+        dump_stack(cpu, 10);
+        watch_resume();
+    }
+}
+
+#define FUZZ_INPUT_MAX (1 << 20)
+
+// Boots to fork_pc once, then every child of the fork server runs one
+// test case. The case goes through the uart rx path, or into ram at
+// buffer_addr as a length word followed by the data. Illegal opcodes and
+// a stack pointer above the top of the stack abort the child, hangs are
+// caught by the fuzzer's timeout.
+int fuzz(cpu_t *cpu, uint32_t fork_pc, const char *input_file, const char *buffer_addr)
+{
+    static uint8_t input[FUZZ_INPUT_MAX];
+    FILE *file = NULL;
+    uint32_t len, addr, prev = 0, pc = 0;
+    uint8_t opcode = 0;
+
+    if (fuzz_init() != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // the boot sees an empty rx line, stdin is left untouched until the
+    // child reads its test case
+    uart_set_input(cpu->uart, input, 0);
+
+    while(!cpu->status && cpu->pc != fork_pc)
+    {
+        cpu_step(cpu);
+    }
+    if (cpu->status)
+    {
+        printf("cpu stopped before reaching %08x\n", fork_pc);
+        return EXIT_FAILURE;
+    }
+
+    fflush(stdout);
+    fuzz_fork_server();
+
+    file = input_file ? fopen(input_file, "rb") : stdin;
+    if (!file)
+    {
+        printf("could not open input file \"%s\"", input_file);
+        return EXIT_FAILURE;
+    }
+    len = fread(input, 1, sizeof(input), file);
+    if (input_file)
+    {
+        fclose(file);
+    }
+
+    if (buffer_addr)
+    {
+        addr = strtoul(buffer_addr, NULL, 16);
+        if (addr > sizeof(cpu->ram) - 4)
+        {
+            printf("input buffer %08x is not in ram\n", addr);
+            return EXIT_FAILURE;
+        }
+        if (len > sizeof(cpu->ram) - 4 - addr)
+        {
+            len = sizeof(cpu->ram) - 4 - addr;
+        }
+        watch_suspend();
+        cpu->ram[addr] = len;
+        cpu->ram[addr + 1] = len >> 8;
+        cpu->ram[addr + 2] = len >> 16;
+        cpu->ram[addr + 3] = len >> 24;
+        memcpy(cpu->ram + addr + 4, input, len);
+        watch_resume();
+    }
+    else
     {
-        printf("%08x = 0x%08x\n", sp+4, cpu_read(sp+4,cpu));
+        uart_set_input(cpu->uart, input, len);
     }
+
+    while(!cpu->status)
+    {
+        pc = cpu->pc;
+        opcode = cpu_step(cpu);
+        FUZZ_EDGE(prev, pc);
+        report_watch(cpu, pc);
+        if (cpu->sp > 0x00FFFFFC)
+        {
+            printf("Bad stack pointer %08x after instruction at %08x\n", cpu->sp, pc);
+            fflush(stdout);
+            abort();
+        }
+    }
+    if (cpu->status == 2)
+    {
+        printf("Illegal opcode \"%02x\" at %08x\n", opcode, pc);
+        fflush(stdout);
+        abort();
+    }
+    return EXIT_SUCCESS;
+}
+
+static void count_opcode_pair(int *prev_opcode, uint8_t opcode)
+{
+    if (*prev_opcode >= 0)
+    {
+        opcode_pairs[*prev_opcode][opcode]++;
+    }
+    *prev_opcode = opcode;
+}
+
+// executes one instruction with the options that look at every one:
+// coverage, opcode pairs if prev_opcode is set, watchpoints, stats and
+// cycles
+static uint8_t step_instrumented(cpu_t *cpu, int coverage_on, int *prev_opcode, stats_t *stats, const char *stats_file,
+    cycles_t *cycles)
+{
+    uint32_t pc = cpu->pc;
+    uint64_t interrupts = cpu->interrupts;
+    uint8_t opcode;
+
+    if (coverage_on)
+    {
+        COVERAGE_MARK(pc);
+    }
+    if (cycles)
+    {
+        // the accesses of the instruction that runs, after an interrupt
+        // entry the first one of the handler
+        cpu_poll(cpu);
+        cycles_step(cycles, cpu, cpu->interrupts != interrupts);
+        opcode = cpu_execute(cpu);
+    }
+    else
+    {
+        opcode = cpu_step(cpu);
+    }
+    if (prev_opcode)
+    {
+        count_opcode_pair(prev_opcode, opcode);
+    }
+    report_watch(cpu, pc);
+    if (stats)
+    {
+        stats->opcodes[opcode]++;
+        // SIGUSR1, the guest keeps running
+        if (stats_dump_requested)
+        {
+            stats_dump_requested = 0;
+            stats_write(stats, cpu, stats_file);
+        }
+    }
+    return opcode;
 }
 
 int main(int argc, char *argv[])
 {
     cpu_t *cpu = cpu_create();
     uint8_t opcode;
+    int prev_opcode = -1;
 
     FILE *file = NULL;
     char *dump_ram = NULL;
     char *dump_flash = NULL;
+    char *dump_pairs = NULL;
+    char *cores = NULL;
+    char *save_snapshot = NULL;
+    char *load_snapshot = NULL;
+    char *snapshot_pc = NULL;
+    uint8_t *flash_image = NULL;
+    char *pace_multiplier = NULL;
+    pace_t pace;
+    uint32_t executed;
+    char *coverage_file = NULL;
+    char *watch_write = NULL;
+    char *watch_access = NULL;
+    char *fuzz_pc = NULL;
+    char *fuzz_input = NULL;
+    char *fuzz_buffer = NULL;
+    char *stats_file = NULL;
+    stats_t stats;
+    char *cycles_config = NULL;
+    cycles_t cycles;
+    uint32_t pc;
     char **buffer = NULL;
-    int i;
+    int i, core_count = 1, compact = 0;
+    size_t len;
 
-    if(argc != 2 && argc != 4 && argc != 6)
+    // like fasm, short immediates and relative branches for a source
+    if(argc > 1 && (strcmp(argv[1], "--compact") == 0 || strcmp(argv[1], "-k") == 0))
     {
-        puts("usage: fsim <in> [--dumpram|-r <ram filename>] [--dumpflash|-f <flash filename>]");
+        compact = 1;
+        ++argv;
+        --argc;
+    }
+
+    if(argc < 2 || argc % 2 != 0)
+    {
+        puts("usage: fsim [--compact|-k] <flash image or .fasm source> [--dumpram|-r <ram filename>] [--dumpflash|-f <flash filename>] [--pairs|-p <pairs filename>]"
+             " [--save-snapshot|-s <snapshot filename> [--snapshot-pc|-m <hex address>]] [--load-snapshot|-l <snapshot filename>]"
+             " [--cores|-n <count>] [--pace|-t <multiplier of the cpu frequency>] [--coverage|-c <coverage filename>]"
+             " [--watch|-w <hex address>[:<hex length>],...] [--watch-access|-a <hex address>[:<hex length>],...]"
+             " [--fuzz|-z <hex fork address> [--fuzz-input|-i <input filename>] [--fuzz-buffer|-b <hex address>]]"
+             " [--stats|-j <json filename>] [--cycles|-y <flash wait states>[:<ram wait states>[:<io wait states>]]]");
         return EXIT_SUCCESS;
     }
     for (i = 2; i < argc; i++)
@@ -43,6 +352,62 @@ int main(int argc, char *argv[])
         {
             buffer = &dump_flash;
         }
+        else if (memcmp("--pairs", argv[i], 7) == 0 || memcmp("-p", argv[i], 2) == 0)
+        {
+            buffer = &dump_pairs;
+        }
+        else if (memcmp("--save-snapshot", argv[i], 15) == 0 || memcmp("-s", argv[i], 2) == 0)
+        {
+            buffer = &save_snapshot;
+        }
+        else if (memcmp("--load-snapshot", argv[i], 15) == 0 || memcmp("-l", argv[i], 2) == 0)
+        {
+            buffer = &load_snapshot;
+        }
+        else if (memcmp("--snapshot-pc", argv[i], 13) == 0 || memcmp("-m", argv[i], 2) == 0)
+        {
+            buffer = &snapshot_pc;
+        }
+        else if (memcmp("--cores", argv[i], 7) == 0 || memcmp("-n", argv[i], 2) == 0)
+        {
+            buffer = &cores;
+        }
+        else if (memcmp("--pace", argv[i], 6) == 0 || memcmp("-t", argv[i], 2) == 0)
+        {
+            buffer = &pace_multiplier;
+        }
+        else if (memcmp("--coverage", argv[i], 10) == 0 || memcmp("-c", argv[i], 2) == 0)
+        {
+            buffer = &coverage_file;
+        }
+        else if (memcmp("--watch-access", argv[i], 14) == 0 || memcmp("-a", argv[i], 2) == 0)
+        {
+            buffer = &watch_access;
+        }
+        else if (memcmp("--watch", argv[i], 7) == 0 || memcmp("-w", argv[i], 2) == 0)
+        {
+            buffer = &watch_write;
+        }
+        else if (memcmp("--fuzz-input", argv[i], 12) == 0 || memcmp("-i", argv[i], 2) == 0)
+        {
+            buffer = &fuzz_input;
+        }
+        else if (memcmp("--fuzz-buffer", argv[i], 13) == 0 || memcmp("-b", argv[i], 2) == 0)
+        {
+            buffer = &fuzz_buffer;
+        }
+        else if (memcmp("--fuzz", argv[i], 6) == 0 || memcmp("-z", argv[i], 2) == 0)
+        {
+            buffer = &fuzz_pc;
+        }
+        else if (memcmp("--stats", argv[i], 7) == 0 || memcmp("-j", argv[i], 2) == 0)
+        {
+            buffer = &stats_file;
+        }
+        else if (memcmp("--cycles", argv[i], 8) == 0 || memcmp("-y", argv[i], 2) == 0)
+        {
+            buffer = &cycles_config;
+        }
         else if (buffer)
         {
             *buffer = argv[i];
@@ -60,67 +425,231 @@ int main(int argc, char *argv[])
          return EXIT_FAILURE;
     }
 
-    file = fopen(argv[1], "r");
+    if (cores)
+    {
+        core_count = atoi(cores);
+        if (core_count < 1 || core_count > CPU_MAX_CORES)
+        {
+            printf("core count must be 1 to %d\n", CPU_MAX_CORES);
+            return EXIT_FAILURE;
+        }
+        if (core_count > 1 && (save_snapshot || load_snapshot))
+        {
+            puts("snapshots only support one core");
+            return EXIT_FAILURE;
+        }
+        // the fault handler single steps the host thread of core 0
+        if (core_count > 1 && (watch_write || watch_access))
+        {
+            puts("watchpoints only support one core");
+            return EXIT_FAILURE;
+        }
+        if (core_count > 1 && fuzz_pc)
+        {
+            puts("fuzzing only supports one core");
+            return EXIT_FAILURE;
+        }
+        if (core_count > 1 && stats_file)
+        {
+            puts("stats only support one core");
+            return EXIT_FAILURE;
+        }
+        if (core_count > 1 && cycles_config)
+        {
+            puts("cycles only support one core");
+            return EXIT_FAILURE;
+        }
+    }
 
-    if(!file)
+    // a source is assembled straight into flash
+    len = strlen(argv[1]);
+    if (len > 5 && strcmp(argv[1] + len - 5, ".fasm") == 0)
+    {
+        if (fasm_assemble(argv[1], NULL, compact, cpu->flash, sizeof(cpu->flash)) < 0)
+        {
+            cpu = cpu_free(cpu);
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        file = fopen(argv[1], "r");
+
+        if(!file)
+        {
+            printf("could not open file \"%s\"",argv[1]);
+            return EXIT_FAILURE;
+        }
+
+        fread(cpu->flash, sizeof(cpu->flash), 1, file);
+
+        fclose(file);
+        file = NULL;
+    }
+
+    // pages equal to the boot image are left out of a snapshot
+    if (save_snapshot)
+    {
+        flash_image = malloc(sizeof(cpu->flash));
+        memcpy(flash_image, cpu->flash, sizeof(cpu->flash));
+    }
+
+    if (load_snapshot && snapshot_load(cpu, load_snapshot) != 0)
     {
-        printf("could not open file \"%s\"",argv[1]);
+        free(flash_image);
+        cpu = cpu_free(cpu);
         return EXIT_FAILURE;
     }
 
-    fread(cpu->flash, sizeof(cpu->flash), 1, file);
+    if (coverage_file)
+    {
+        load_coverage(coverage_file);
+    }
 
-    fclose(file);
-    file = NULL;
+    // after loading, the image and snapshot writes are no hits
+    if (watch_write || watch_access)
+    {
+        cpu = watch_init(cpu);
+        if ((watch_write && add_watchpoints(cpu, watch_write, 0) != 0) ||
+            (watch_access && add_watchpoints(cpu, watch_access, 1) != 0))
+        {
+            free(flash_image);
+            cpu = watch_clear(cpu);
+            cpu = cpu_free(cpu);
+            return EXIT_FAILURE;
+        }
+    }
 
-    printf("First 160 bytes of flash:");
-    for(i = 0;i < 160; i++) {
-        if (i % 16 == 0)
+    if (fuzz_pc)
+    {
+        i = fuzz(cpu, strtoul(fuzz_pc, NULL, 16), fuzz_input, fuzz_buffer);
+        free(flash_image);
+        cpu = watch_clear(cpu);
+        cpu = cpu_free(cpu);
+        return i;
+    }
+
+    dump_flash_head(cpu, 160);
+
+    if (stats_file)
+    {
+        stats_init(&stats, cpu);
+    }
+
+    if (cycles_config && cycles_init(&cycles, cycles_config) != 0)
+    {
+        free(flash_image);
+        cpu = watch_clear(cpu);
+        cpu = cpu_free(cpu);
+        return EXIT_FAILURE;
+    }
+
+    if (core_count > 1)
+    {
+        smp_start(cpu, core_count);
+    }
+
+    // run up to a write to Snapshot Marker or up to the pc, e.g. at the
+    // end of os initialization, and snapshot there instead of at halt
+    if (save_snapshot)
+    {
+        uint32_t marker = snapshot_pc ? strtoul(snapshot_pc, NULL, 16) : 0;
+
+        while(!cpu->status && !cpu->snapshot_marker && (!snapshot_pc || cpu->pc != marker))
         {
-            printf("\n%08x:", i + 0x01000000);
+            opcode = step_instrumented(cpu, coverage_file != NULL, dump_pairs ? &prev_opcode : NULL, stats_file ? &stats : NULL, stats_file,
+                cycles_config ? &cycles : NULL);
         }
-        if (i % 2 == 0)
+        if (!cpu->status)
         {
-            printf(" ");
+            watch_suspend();
+            snapshot_save(cpu, flash_image, save_snapshot);
+            watch_resume();
+            save_snapshot = NULL;
         }
-        printf("%02x", cpu->flash[i]);
     }
-    printf("\n\n");
 
-    while(!cpu->status)
+    // one instruction per cycle of the cpu frequency register
+    if (pace_multiplier)
     {
-        opcode = cpu_step(cpu);
+        pace_init(&pace, cpu_read(0xFF00000A, cpu) * atof(pace_multiplier));
+        if (pace.rate <= 0)
+        {
+            puts("Pacing needs a positive cpu frequency and multiplier");
+            if (core_count > 1)
+            {
+                smp_stop(cpu);
+            }
+            free(flash_image);
+            cpu = watch_clear(cpu);
+            cpu = cpu_free(cpu);
+            return EXIT_FAILURE;
+        }
+        while(!cpu->status)
+        {
+            for (executed = 0; executed < pace.quantum && !cpu->status; executed++)
+            {
+                opcode = step_instrumented(cpu, coverage_file != NULL, dump_pairs ? &prev_opcode : NULL, stats_file ? &stats : NULL, stats_file,
+                    cycles_config ? &cycles : NULL);
+            }
+            pace_quantum(&pace, executed);
+        }
+    }
+    // every instruction on its own, e.g. a watchpoint hit is reported
+    // with the pc of a single instruction
+    else if (dump_pairs || watch_write || watch_access || stats_file || cycles_config)
+    {
+        while(!cpu->status)
+        {
+            opcode = step_instrumented(cpu, coverage_file != NULL, dump_pairs ? &prev_opcode : NULL, stats_file ? &stats : NULL, stats_file,
+                cycles_config ? &cycles : NULL);
+        }
+    }
+    else if (coverage_file)
+    {
+        // the fast path plus one bit-set per instruction, the second
+        // instruction of a fused pair follows an INX (1 byte) when the
+        // pair ends in JMP, otherwise a 5 byte instruction
+        while(!cpu->status)
+        {
+            pc = cpu->pc;
+            COVERAGE_MARK(pc);
+            if (cpu_step_fused(cpu, &opcode) == 2)
+            {
+                pc += opcode == 0xD0 ? 1 : 5;
+                COVERAGE_MARK(pc);
+            }
+        }
+    }
+    else
+    {
+        while(!cpu->status)
+        {
+            cpu_step_fused(cpu, &opcode);
+        }
+    }
+    if (core_count > 1)
+    {
+        smp_stop(cpu);
+    }
+    if (watch_write || watch_access)
+    {
+        cpu = watch_clear(cpu);
+    }
+
+    dump_exit(cpu, opcode);
+
+    if (pace_multiplier)
+    {
+        puts("");
+        pace_report(&pace);
+    }
+
+    if (cycles_config)
+    {
+        puts("");
+        cycles_report(&cycles);
     }
-    switch (cpu->status)
-    {
-        case 2:
-            printf("Illegal opcode \"%02x\"\n", opcode);
-            break;
-        case 1:
-            puts("");
-            puts("####################");
-            puts("#        ##        #");
-            puts("#### Halted CPU ####");
-            puts("#        ##        #");
-            puts("####################");
-            puts("");
-            break;
-        default:
-            printf("Unknown exit status %d", cpu->status);
-    }
-
-    puts("Register Dump:");
-    printf("A  = %08x\n", cpu->a);
-    printf("X  = %08x\n", cpu->x);
-    printf("PC = %08x\n", cpu->pc);
-    printf("SP = %08x\n", cpu->sp);
-    printf("z  = %01d\n", cpu->z);
-    printf("n  = %01d\n", cpu->n);
-    printf("i  = %01d\n", cpu->i);
-    printf("if = %02x\n", cpu->interrupt_flags);
-    printf("iv = %08x\n", cpu->interrupt_vector);
-    puts("");
-    dump_stack(cpu, 10);
 
     if (dump_flash)
     {
@@ -147,6 +676,25 @@ int main(int argc, char *argv[])
             printf("Dumped ram to \"%s\"\n", dump_ram);
         }
     }
+    if (dump_pairs)
+    {
+        dump_opcode_pairs(dump_pairs);
+    }
+    if (coverage_file)
+    {
+        save_coverage(coverage_file);
+    }
+    if (stats_file)
+    {
+        stats_write(&stats, cpu, stats_file);
+        printf("Wrote stats to \"%s\"\n", stats_file);
+    }
+    if (save_snapshot && cpu->status == 1)
+    {
+        snapshot_save(cpu, flash_image, save_snapshot);
+    }
+    free(flash_image);
+    semihost_close_all();
     cpu = cpu_free(cpu);
 
     return 0;
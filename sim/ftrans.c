@@ -0,0 +1,675 @@
+#include "native.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// ftrans: translates a flash image into C, one function per reachable
+// basic block and a lookup from pc to block. Linked with native.c and
+// the simulator core it runs the image like fsim, see native.h.
+// With the fasm listing the code assembled for RAM (e.g. behind
+// boot.fasm) is translated at its RAM address as well.
+
+#define FLASH_START 0x01000000u
+
+// *= in the listing that start RAM code in the image
+#define MAX_SEGMENTS 64
+
+typedef enum
+{
+    k_interp, // executed by the interpreter, the block goes on after it
+    k_end,    // executed by the interpreter, ends the block
+    k_ldab, k_ldxb, k_stab, k_stxb, k_lda, k_ldx, k_sta, k_stx,
+    k_and, k_or, k_xor, k_ror, k_rol, k_lsr, k_lsl, k_add, k_cmp,
+    k_sub, k_adc, k_sbc, k_mul, k_div, k_mod,
+    k_jmp, k_beq, k_bne, k_bgt, k_blt, k_jts, k_rts,
+    k_txa, k_tax, k_txs, k_tsx, k_pua, k_pux, k_puf, k_poa, k_pox, k_pof,
+    k_ina, k_inx, k_dea, k_dex, k_sei, k_cli, k_nop
+} kind_t;
+
+typedef enum
+{
+    m_none, m_imm, m_abs, m_ix, m_io, m_short, m_rel8, m_rel16, m_inc, m_dec
+} addr_mode_t;
+
+typedef struct
+{
+    uint8_t kind, mode, valid;
+} opcode_t;
+
+static opcode_t opcodes[256];
+
+static uint8_t *image;
+static uint32_t image_size;
+
+// bytes of the image assembled for RAM at addr, the program copies them
+// there before it jumps to them
+typedef struct
+{
+    uint32_t addr, offset, size;
+} segment_t;
+
+static segment_t segments[MAX_SEGMENTS];
+static uint32_t segment_count;
+
+// block starts found so far, visited in order. seen has a flag per
+// byte of the image for flash and another one for RAM addresses.
+static uint8_t *seen;
+static uint32_t *roots;
+static uint32_t root_count;
+
+static void def(uint8_t op, kind_t kind, addr_mode_t mode)
+{
+    opcodes[op].kind = kind;
+    opcodes[op].mode = mode;
+    opcodes[op].valid = 1;
+}
+
+// the four usual modes in the order immediate, absolute, ($a,X), ($a),X
+static void def4(uint8_t op, kind_t kind)
+{
+    def(op, kind, m_imm);
+    def(op + 1, kind, m_abs);
+    def(op + 2, kind, m_ix);
+    def(op + 3, kind, m_io);
+}
+
+// absolute, ($a,X), ($a),X
+static void def3(uint8_t op, kind_t kind)
+{
+    def(op, kind, m_abs);
+    def(op + 1, kind, m_ix);
+    def(op + 2, kind, m_io);
+}
+
+static void init_opcodes()
+{
+    static const kind_t shorts[] = { k_lda, k_ldx, k_and, k_or, k_xor, k_ror, k_rol, k_lsr, k_lsl, k_add, k_cmp, k_sub };
+    static const kind_t branches[] = { k_jmp, k_beq, k_bne, k_bgt, k_blt };
+    int i;
+
+    def(0x7f, k_ldab, m_abs); def(0x7e, k_ldab, m_ix); def(0x7d, k_ldab, m_io);
+    def(0x70, k_ldxb, m_abs); def(0x71, k_ldxb, m_ix); def(0x72, k_ldxb, m_io);
+    def(0x60, k_stab, m_abs); def(0x61, k_stab, m_ix); def(0x62, k_stab, m_io);
+    def(0x6d, k_stxb, m_abs); def(0x6e, k_stxb, m_ix); def(0x6f, k_stxb, m_io);
+    def(0xaf, k_lda, m_imm); def(0xae, k_lda, m_abs); def(0xad, k_lda, m_ix); def(0xac, k_lda, m_io);
+    def4(0xa0, k_ldx);
+    def3(0x90, k_sta);
+    def3(0x9d, k_stx);
+    def(0x58, k_ldab, m_inc); def(0x59, k_ldab, m_dec);
+    def(0x5a, k_stab, m_inc); def(0x5b, k_stab, m_dec);
+    def(0x5c, k_lda, m_inc); def(0x5d, k_lda, m_dec);
+    def(0x5e, k_sta, m_inc); def(0x5f, k_sta, m_dec);
+
+    def4(0xf0, k_and);
+    def4(0xf4, k_or);
+    def4(0xf8, k_xor);
+    def4(0xfc, k_ror);
+    def4(0xe1, k_rol);
+    def4(0xe5, k_lsr);
+    def4(0xe9, k_lsl);
+    def4(0xc0, k_add);
+    def4(0xc4, k_cmp);
+    def4(0x40, k_sub);
+    def4(0x44, k_adc);
+    def4(0x48, k_sbc);
+    def4(0x4c, k_mul);
+    def4(0x50, k_div);
+    def4(0x54, k_mod);
+    for(i = 0; i < 12; i++)
+    {
+        def(0x20 + i, shorts[i], m_short);
+    }
+
+    def3(0xd0, k_jmp);
+    def3(0xd3, k_bne);
+    def3(0xd6, k_bgt);
+    def3(0xd9, k_blt);
+    def3(0xdc, k_beq);
+    def3(0xbc, k_jts);
+    for(i = 0; i < 5; i++)
+    {
+        def(0x30 + i, branches[i], m_rel8);
+        def(0x38 + i, branches[i], m_rel16);
+    }
+
+    // atomics are rare, they stay in the core
+    def3(0x84, k_interp);
+    def3(0x87, k_interp);
+
+    def(0xa9, k_txa, m_none);
+    def(0xaa, k_tax, m_none);
+    def(0xb0, k_txs, m_none);
+    def(0xb1, k_tsx, m_none);
+    def(0xb2, k_pua, m_none);
+    def(0xb3, k_pux, m_none);
+    def(0xb6, k_puf, m_none);
+    def(0xb4, k_poa, m_none);
+    def(0xb5, k_pox, m_none);
+    def(0xb7, k_pof, m_none);
+    def(0xbf, k_rts, m_none);
+    def(0xb8, k_end, m_none); // rti
+    def(0xc8, k_ina, m_none);
+    def(0xc9, k_inx, m_none);
+    def(0xca, k_dea, m_none);
+    def(0xcb, k_dex, m_none);
+    def(0x80, k_sei, m_none);
+    def(0x81, k_cli, m_none);
+    def(0x82, k_nop, m_none);
+    def(0x83, k_end, m_none); // hlt
+}
+
+static uint32_t instr_length(addr_mode_t mode)
+{
+    switch(mode)
+    {
+        case m_none: return 1;
+        case m_short: case m_rel8: return 2;
+        case m_rel16: return 3;
+        default: return 5;
+    }
+}
+
+// the image offset of len bytes at addr, 0 if they are not in the image
+static int in_image(uint32_t addr, uint32_t len, uint32_t *offset)
+{
+    const segment_t *segment;
+
+    if (addr >= FLASH_START)
+    {
+        *offset = addr - FLASH_START;
+        return *offset <= image_size && len <= image_size - *offset;
+    }
+    for(segment = segments; segment != segments + segment_count; segment++)
+    {
+        if (addr - segment->addr < segment->size && len <= segment->size - (addr - segment->addr))
+        {
+            *offset = segment->offset + (addr - segment->addr);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void add_root(uint32_t addr)
+{
+    uint32_t offset;
+
+    if (in_image(addr, 1, &offset))
+    {
+        offset += addr < FLASH_START ? image_size : 0;
+        if (!seen[offset])
+        {
+            seen[offset] = 1;
+            roots[root_count++] = addr;
+        }
+    }
+}
+
+typedef struct
+{
+    uint32_t pc, next, param;
+    uint8_t opcode;
+    const opcode_t *op;
+} instr_t;
+
+// 0 at the end of the image or an unknown opcode
+static int decode(uint32_t pc, instr_t *instr)
+{
+    const uint8_t *p;
+    uint32_t offset;
+
+    if (!in_image(pc, 1, &offset))
+    {
+        return 0;
+    }
+    p = image + offset;
+    instr->pc = pc;
+    instr->opcode = p[0];
+    instr->op = &opcodes[p[0]];
+    if (!instr->op->valid || !in_image(pc, instr_length(instr->op->mode), &offset))
+    {
+        return 0;
+    }
+    instr->next = pc + instr_length(instr->op->mode);
+    switch(instr->op->mode)
+    {
+        case m_none:
+            instr->param = 0;
+            break;
+        case m_short:
+            instr->param = (int8_t)p[1];
+            break;
+        case m_rel8:
+            instr->param = instr->next + (int8_t)p[1];
+            break;
+        case m_rel16:
+            instr->param = instr->next + (int16_t)(p[1] | p[2] << 8);
+            break;
+        default:
+            instr->param = p[1] | p[2] << 8 | p[3] << 16 | (uint32_t)p[4] << 24;
+    }
+    return 1;
+}
+
+static int is_branch(kind_t kind)
+{
+    return kind == k_jmp || kind == k_beq || kind == k_bne || kind == k_bgt || kind == k_blt || kind == k_jts;
+}
+
+static const char *conditions[] = {
+    "1", "NATIVE_Z", "!NATIVE_Z", "!NATIVE_Z && !NATIVE_N", "!NATIVE_Z && NATIVE_N"
+};
+
+static void emit_fallback(FILE *out, const instr_t *in)
+{
+    fprintf(out, "    if (native_step(cpu, 0x%08xu, 0x%08xu))\n    {\n        return;\n    }\n", in->pc, in->next);
+}
+
+// the c condition that sets ea for a memory operand of the mode, NULL if
+// the operand never is plain memory
+static const char* ea_condition(const instr_t *in, uint32_t n, int store, char *buf)
+{
+    const char *check = store ? "native_ram" : "native_mem";
+
+    switch(in->op->mode)
+    {
+        case m_abs:
+            if (store ? in->param > 0x01000000u - n : !(in->param <= 0x01000000u - n ||
+                (in->param >= 0x01000000u && in->param <= 0x02000000u - n)))
+            {
+                return NULL;
+            }
+            sprintf(buf, "(ea = 0x%08xu, 1)", in->param);
+            return buf;
+        case m_ix:
+            sprintf(buf, "native_ea_ix(cpu, 0x%08xu, &ea) && %s(ea, %u)", in->param, check, n);
+            return buf;
+        default:
+            sprintf(buf, "native_ea_io(cpu, 0x%08xu, &ea) && %s(ea, %u)", in->param, check, n);
+            return buf;
+    }
+}
+
+// an access of n bytes through ea with the body, the interpreter if
+// the address is not plain memory
+static void emit_access(FILE *out, const instr_t *in, uint32_t n, int store, const char *body)
+{
+    char buf[100];
+    const char *cond = ea_condition(in, n, store, buf);
+
+    if (!cond)
+    {
+        emit_fallback(out, in);
+        return;
+    }
+    fprintf(out, "    if (%s)\n    {\n        cpu->fused_clocks++;\n%s", cond, body);
+    if (in->op->mode == m_inc || in->op->mode == m_dec)
+    {
+        fprintf(out, "        cpu->x %s= %u;\n", in->op->mode == m_inc ? "+" : "-", n);
+    }
+    fprintf(out, "    }\n    else if (native_step(cpu, 0x%08xu, 0x%08xu))\n    {\n        return;\n    }\n", in->pc, in->next);
+}
+
+static const char* alu_body(kind_t kind)
+{
+    switch(kind)
+    {
+        case k_lda: return "        cpu->a = v;\n        NATIVE_SET_Z(cpu->a);\n";
+        case k_ldx: return "        cpu->x = v;\n        NATIVE_SET_Z(cpu->x);\n";
+        case k_and: return "        cpu->a &= v;\n        NATIVE_SET_Z(cpu->a);\n";
+        case k_or:  return "        cpu->a |= v;\n        NATIVE_SET_Z(cpu->a);\n";
+        case k_xor: return "        cpu->a ^= v;\n        NATIVE_SET_Z(cpu->a);\n";
+        case k_ror: return "        v &= 31;\n        cpu->a = cpu->a >> v | cpu->a << ((32 - v) & 31);\n        NATIVE_SET_Z(cpu->a);\n";
+        case k_rol: return "        v &= 31;\n        cpu->a = cpu->a << v | cpu->a >> ((32 - v) & 31);\n        NATIVE_SET_Z(cpu->a);\n";
+        case k_lsr: return "        cpu->a = v < 32 ? cpu->a >> v : 0;\n        NATIVE_SET_Z(cpu->a);\n";
+        case k_lsl: return "        cpu->a = v < 32 ? cpu->a << v : 0;\n        NATIVE_SET_Z(cpu->a);\n";
+        case k_cmp: return "        NATIVE_SET_CMP(v, cpu->a);\n";
+        case k_add: return "        r = (uint64_t)cpu->a + v;\n        cpu->c = r >> 32;\n        cpu->a = r;\n"
+                           "        NATIVE_SET_ZN(cpu->a);\n";
+        case k_sub: return "        cpu->c = v > cpu->a;\n        cpu->a -= v;\n"
+                           "        NATIVE_SET_ZN(cpu->a);\n";
+        case k_adc: return "        r = (uint64_t)cpu->a + v + cpu->c;\n        cpu->c = r >> 32;\n        cpu->a = r;\n"
+                           "        NATIVE_SET_ZN(cpu->a);\n";
+        case k_sbc: return "        r = (uint64_t)cpu->a - v - cpu->c;\n        cpu->c = (r >> 32) != 0;\n        cpu->a = r;\n"
+                           "        NATIVE_SET_ZN(cpu->a);\n";
+        case k_mul: return "        r = (uint64_t)cpu->a * v;\n        cpu->c = (r >> 32) != 0;\n        cpu->a = r;\n"
+                           "        NATIVE_SET_ZN(cpu->a);\n";
+        case k_div: return "        cpu->c = v == 0;\n        cpu->a = v ? cpu->a / v : 0xFFFFFFFFu;\n"
+                           "        NATIVE_SET_ZN(cpu->a);\n";
+        default:    return "        cpu->c = v == 0;\n        if (v)\n        {\n            cpu->a %= v;\n        }\n"
+                           "        NATIVE_SET_ZN(cpu->a);\n";
+    }
+}
+
+// a push of the c expression value, the interpreter if sp is not in ram
+static void emit_push(FILE *out, const instr_t *in, const char *value, const char *flags)
+{
+    fprintf(out, "    if (native_ram(cpu->sp, 4))\n    {\n"
+                 "        cpu->fused_clocks++;\n        native_wr32(cpu, cpu->sp, %s);\n        cpu->sp -= 4;\n%s"
+                 "    }\n    else if (native_step(cpu, 0x%08xu, 0x%08xu))\n    {\n        return;\n    }\n",
+            value, flags, in->pc, in->next);
+}
+
+static void emit_pop(FILE *out, const instr_t *in, const char *body)
+{
+    fprintf(out, "    if (native_ram(cpu->sp + 4, 4))\n    {\n"
+                 "        cpu->fused_clocks++;\n        cpu->sp += 4;\n        v = native_rd32(cpu, cpu->sp);\n%s"
+                 "    }\n    else if (native_step(cpu, 0x%08xu, 0x%08xu))\n    {\n        return;\n    }\n",
+            body, in->pc, in->next);
+}
+
+// jumps, branches and jts, always end the block
+static void emit_branch(FILE *out, const instr_t *in)
+{
+    kind_t kind = in->op->kind;
+    const char *cond = conditions[kind == k_jts ? 0 : kind - k_jmp];
+    const char *ea;
+    char buf[100];
+
+    if (in->op->mode == m_ix)
+    {
+        sprintf(buf, "native_ea_ix(cpu, 0x%08xu, &ea)", in->param);
+        ea = buf;
+    }
+    else if (in->op->mode == m_io)
+    {
+        sprintf(buf, "native_ea_io(cpu, 0x%08xu, &ea)", in->param);
+        ea = buf;
+    }
+    else
+    {
+        sprintf(buf, "(ea = 0x%08xu, 1)", in->param);
+        ea = buf;
+    }
+
+    if (kind == k_jts)
+    {
+        fprintf(out, "    if (%s && native_ram(cpu->sp, 4))\n    {\n"
+                     "        cpu->fused_clocks++;\n        native_wr32(cpu, cpu->sp, 0x%08xu);\n        cpu->sp -= 4;\n"
+                     "        cpu->pc = ea;\n        return;\n    }\n", ea, in->next);
+        fprintf(out, "    native_step(cpu, 0x%08xu, 0x%08xu);\n    return;\n", in->pc, in->next);
+        return;
+    }
+
+    if (kind != k_jmp)
+    {
+        fprintf(out, "    if (!(%s))\n    {\n        cpu->fused_clocks++;\n        cpu->pc = 0x%08xu;\n        return;\n    }\n", cond, in->next);
+    }
+    fprintf(out, "    if (%s)\n    {\n        cpu->fused_clocks++;\n        cpu->pc = ea;\n        return;\n    }\n", ea);
+    fprintf(out, "    native_step(cpu, 0x%08xu, 0x%08xu);\n    return;\n", in->pc, in->next);
+}
+
+// Translates the block at pc, the blocks it continues with are added as
+// roots. A block in RAM is r_ and b_ checks that RAM still holds the
+// code it was translated from, the interpreter runs it otherwise (not
+// copied yet, overwritten, ...).
+static void translate_block(FILE *out, uint32_t pc)
+{
+    instr_t in;
+    char body[200];
+    int count, end = 0;
+    kind_t kind;
+    const uint32_t start = pc;
+    uint32_t offset;
+
+    fprintf(out, "static void %c_%08x(cpu_t *cpu)\n{\n    uint32_t ea = 0, v = 0;\n    uint64_t r = 0;\n\n",
+            start < FLASH_START ? 'r' : 'b', start);
+    fprintf(out, "    (void)ea;\n    (void)v;\n    (void)r;\n\n");
+
+    for(count = 0; !end; count++)
+    {
+        if (count == NATIVE_MAX_BLOCK)
+        {
+            add_root(pc);
+            fprintf(out, "    cpu->pc = 0x%08xu;\n    return;\n", pc);
+            break;
+        }
+        if (!decode(pc, &in))
+        {
+            // end of the image or illegal, the interpreter reports it
+            fprintf(out, "    native_step(cpu, 0x%08xu, 0x%08xu);\n    return;\n", pc, pc);
+            break;
+        }
+
+        kind = in.op->kind;
+        fprintf(out, "    // %08x: %02x\n", in.pc, in.opcode);
+
+        if (kind == k_ldab || kind == k_ldxb || kind == k_stab || kind == k_stxb)
+        {
+            switch(kind)
+            {
+                case k_ldab: strcpy(body, "        cpu->a = (cpu->a & ~0xFFu) | native_ptr(cpu, ea)[0];\n        NATIVE_SET_Z(cpu->a);\n"); break;
+                case k_ldxb: strcpy(body, "        cpu->x = (cpu->x & ~0xFFu) | native_ptr(cpu, ea)[0];\n        NATIVE_SET_Z(cpu->x);\n"); break;
+                case k_stab: strcpy(body, "        native_ptr(cpu, ea)[0] = cpu->a;\n"); break;
+                default:     strcpy(body, "        native_ptr(cpu, ea)[0] = cpu->x;\n"); break;
+            }
+            emit_access(out, &in, 1, kind == k_stab || kind == k_stxb, body);
+        }
+        else if (kind == k_sta || kind == k_stx)
+        {
+            sprintf(body, "        native_wr32(cpu, ea, cpu->%s);\n", kind == k_sta ? "a" : "x");
+            emit_access(out, &in, 4, 1, body);
+        }
+        else if (kind >= k_lda && kind <= k_mod && kind != k_sta && kind != k_stx)
+        {
+            if (in.op->mode == m_imm || in.op->mode == m_short)
+            {
+                fprintf(out, "    cpu->fused_clocks++;\n    v = 0x%08xu;\n%s", in.param, alu_body(kind));
+            }
+            else
+            {
+                sprintf(body, "        v = native_rd32(cpu, ea);\n%s", alu_body(kind));
+                emit_access(out, &in, 4, 0, body);
+            }
+        }
+        else if (is_branch(kind))
+        {
+            if (in.op->mode != m_ix && in.op->mode != m_io)
+            {
+                add_root(in.param);
+            }
+            if (kind != k_jmp)
+            {
+                add_root(in.next);
+            }
+            emit_branch(out, &in);
+            end = 1;
+        }
+        else
+        {
+            switch(kind)
+            {
+                case k_rts:
+                    emit_pop(out, &in, "        cpu->pc = v;\n        return;\n");
+                    fprintf(out, "    return;\n");
+                    end = 1;
+                    break;
+                case k_txa: fprintf(out, "    cpu->fused_clocks++;\n    cpu->a = cpu->x;\n    NATIVE_SET_Z(cpu->a);\n"); break;
+                case k_tax: fprintf(out, "    cpu->fused_clocks++;\n    cpu->x = cpu->a;\n    NATIVE_SET_Z(cpu->x);\n"); break;
+                case k_txs: fprintf(out, "    cpu->fused_clocks++;\n    cpu->sp = cpu->x;\n    NATIVE_SET_Z(cpu->sp);\n"); break;
+                case k_tsx: fprintf(out, "    cpu->fused_clocks++;\n    cpu->x = cpu->sp;\n    NATIVE_SET_Z(cpu->x);\n"); break;
+                case k_pua: emit_push(out, &in, "cpu->a", "        NATIVE_SET_Z(cpu->a);\n"); break;
+                case k_pux: emit_push(out, &in, "cpu->x", "        NATIVE_SET_Z(cpu->x);\n"); break;
+                case k_puf: emit_push(out, &in, "cpu_flags(cpu)", ""); break;
+                case k_poa: emit_pop(out, &in, "        cpu->a = v;\n        NATIVE_SET_Z(cpu->a);\n"); break;
+                case k_pox: emit_pop(out, &in, "        cpu->x = v;\n        NATIVE_SET_Z(cpu->x);\n"); break;
+                case k_pof:
+                    // may set I with an interrupt pending
+                    emit_pop(out, &in, "        cpu_set_flags(cpu, v);\n");
+                    add_root(in.next);
+                    fprintf(out, "    cpu->pc = 0x%08xu;\n    return;\n", in.next);
+                    end = 1;
+                    break;
+                case k_ina: fprintf(out, "    cpu->fused_clocks++;\n    v = cpu->a++;\n    NATIVE_SET_STEP(cpu->a, v);\n"); break;
+                case k_inx: fprintf(out, "    cpu->fused_clocks++;\n    v = cpu->x++;\n    NATIVE_SET_STEP(cpu->x, v);\n"); break;
+                case k_dea: fprintf(out, "    cpu->fused_clocks++;\n    v = cpu->a--;\n    NATIVE_SET_STEP(cpu->a, v);\n"); break;
+                case k_dex: fprintf(out, "    cpu->fused_clocks++;\n    v = cpu->x--;\n    NATIVE_SET_STEP(cpu->x, v);\n"); break;
+                case k_sei:
+                    add_root(in.next);
+                    fprintf(out, "    cpu->fused_clocks++;\n    cpu->i = 1;\n    cpu->pc = 0x%08xu;\n    return;\n", in.next);
+                    end = 1;
+                    break;
+                case k_cli: fprintf(out, "    cpu->fused_clocks++;\n    cpu->i = 0;\n"); break;
+                case k_nop: fprintf(out, "    cpu->fused_clocks++;\n"); break;
+                case k_end:
+                    fprintf(out, "    native_step(cpu, 0x%08xu, 0x%08xu);\n    return;\n", in.pc, in.next);
+                    end = 1;
+                    break;
+                default:
+                    emit_fallback(out, &in);
+            }
+        }
+        pc = in.next;
+    }
+    fprintf(out, "}\n\n");
+
+    if (start < FLASH_START)
+    {
+        in_image(start, pc - start, &offset);
+        fprintf(out, "static void b_%08x(cpu_t *cpu)\n{\n"
+                     "    if (memcmp(cpu->ram + 0x%08xu, native_image + %u, %u) == 0)\n    {\n"
+                     "        r_%08x(cpu);\n    }\n    else\n    {\n"
+                     "        native_step(cpu, 0x%08xu, 0x%08xu);\n    }\n}\n\n",
+                start, start, offset, pc - start, start, start, start);
+    }
+}
+
+// a jump or jts with a label operand, the indirect modes take a pointer
+static int is_code_reference(const char *mnemonic)
+{
+    const char *mode = mnemonic + 3;
+
+    return (strncmp(mnemonic, "jmp", 3) == 0 || strncmp(mnemonic, "jts", 3) == 0) &&
+        (strcmp(mode, "_absolute") == 0 || strcmp(mode, "_rel8") == 0 || strcmp(mode, "_rel16") == 0);
+}
+
+static void add_segment(uint32_t addr, uint32_t offset, uint32_t size)
+{
+    if (addr < FLASH_START && size && segment_count < MAX_SEGMENTS)
+    {
+        segments[segment_count].addr = addr;
+        segments[segment_count].offset = offset;
+        segments[segment_count].size = size;
+        segment_count++;
+    }
+}
+
+// the segments of RAM code from the *= lines. The address column is
+// where the location counter stands, the bytes since the last *= went
+// into the image one after the other. The last one runs to the end.
+static void load_segments(FILE *file)
+{
+    char line[300], mnemonic[32];
+    uint32_t addr, param, start = 0, offset = 0;
+
+    while(fgets(line, sizeof(line), file) && offset < image_size)
+    {
+        if (sscanf(line, "%x %31s %x", &addr, mnemonic, &param) == 3 && strcmp(mnemonic, "addr_offset") == 0)
+        {
+            add_segment(start, offset, addr - start < image_size - offset ? addr - start : image_size - offset);
+            offset += addr - start;
+            start = param;
+        }
+    }
+    if (offset < image_size)
+    {
+        add_segment(start, offset, image_size - offset);
+    }
+}
+
+static void load_labels(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    char line[300], mnemonic[32], label[256];
+    uint32_t addr, param;
+
+    if (!file)
+    {
+        printf("could not open listing \"%s\"\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    load_segments(file);
+    rewind(file);
+
+    // the listing fasm prints, the labels jumped to are entry points that
+    // control flow from reset may miss (e.g. behind a computed jump).
+    // Other labels may be data and are not decoded.
+    while(fgets(line, sizeof(line), file))
+    {
+        if (sscanf(line, "%x %31s %x %255s", &addr, mnemonic, &param, label) == 4 && is_code_reference(mnemonic))
+        {
+            add_root(param);
+        }
+    }
+    fclose(file);
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *file = NULL, *out = NULL;
+    uint32_t i, n;
+
+    if (argc != 3 && argc != 4)
+    {
+        puts("usage: ftrans <flash image> <c output> [<fasm listing>]");
+        return EXIT_SUCCESS;
+    }
+
+    file = fopen(argv[1], "rb");
+    if (!file)
+    {
+        printf("could not open file \"%s\"\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    image = malloc(0x01000000);
+    image_size = fread(image, 1, 0x01000000, file);
+    fclose(file);
+
+    seen = calloc(2 * image_size + 1, 1);
+    roots = malloc(sizeof(*roots) * (2 * image_size + 1));
+
+    init_opcodes();
+    add_root(FLASH_START);
+    if (argc == 4)
+    {
+        load_labels(argv[3]);
+    }
+
+    out = fopen(argv[2], "w+");
+    if (!out)
+    {
+        printf("could not create file \"%s\"\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(out, "// generated by ftrans from %s\n\n#include \"native.h\"\n\n#include <stddef.h>\n#include <string.h>\n\n", argv[1]);
+    fprintf(out, "const uint32_t native_image_size = %u;\n\nconst uint8_t native_image[] = {", image_size);
+    for(i = 0; i < image_size; i++)
+    {
+        fprintf(out, "%s0x%02x,", i % 16 ? " " : "\n    ", image[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    // translating adds the successors to roots
+    for(n = 0; n < root_count; n++)
+    {
+        translate_block(out, roots[n]);
+    }
+
+    fprintf(out, "native_block_t native_lookup(uint32_t pc)\n{\n    switch (pc)\n    {\n");
+    for(n = 0; n < root_count; n++)
+    {
+        fprintf(out, "        case 0x%08xu: return b_%08x;\n", roots[n], roots[n]);
+    }
+    fprintf(out, "        default: return NULL;\n    }\n}\n");
+    fclose(out);
+
+    printf("translated %u blocks, %u segments of RAM code\n", root_count, segment_count);
+
+    free(roots);
+    free(seen);
+    free(image);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+#include "fuzz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+uint8_t *fuzz_map = NULL;
+
+#ifdef __MINGW32__
+
+int fuzz_init()
+{
+    puts("fuzzing needs fork, not available on this host");
+    return -1;
+}
+
+void fuzz_fork_server()
+{
+}
+
+#else
+
+#include <unistd.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+
+// file descriptors the fuzzer opens for its fork server protocol
+#define FORKSRV_CTL_FD 198
+#define FORKSRV_ST_FD 199
+
+int fuzz_init()
+{
+    char *id = getenv("__AFL_SHM_ID");
+
+    if(!id)
+    {
+        fuzz_map = calloc(FUZZ_MAP_SIZE, 1);
+        return 0;
+    }
+
+    fuzz_map = shmat(atoi(id), NULL, 0);
+    if(fuzz_map == (void*)-1)
+    {
+        printf("could not attach coverage map %s\n", id);
+        fuzz_map = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void fuzz_fork_server()
+{
+    uint32_t msg = 0;
+    pid_t pid;
+    int status;
+
+    // no fuzzer listening, run once
+    if(write(FORKSRV_ST_FD, &msg, 4) != 4)
+    {
+        return;
+    }
+
+    for(;;)
+    {
+        if(read(FORKSRV_CTL_FD, &msg, 4) != 4)
+        {
+            exit(EXIT_SUCCESS);
+        }
+
+        pid = fork();
+        if(pid < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+        if(pid == 0)
+        {
+            close(FORKSRV_CTL_FD);
+            close(FORKSRV_ST_FD);
+            return;
+        }
+
+        if(write(FORKSRV_ST_FD, &pid, 4) != 4 || waitpid(pid, &status, 0) < 0 ||
+           write(FORKSRV_ST_FD, &status, 4) != 4)
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stdint.h>
+
+// size of the shared edge coverage bitmap, as used by AFL
+#define FUZZ_MAP_SIZE (1 << 16)
+
+extern uint8_t *fuzz_map;
+
+// Attaches the shared bitmap named by __AFL_SHM_ID, or a private one when
+// fsim runs outside the fuzzer. Returns 0 on success.
+int fuzz_init();
+
+// Runs the AFL fork server. Returns in every forked child, the parent only
+// exits when the fuzzer goes away. Without a fuzzer it returns at once and
+// the single run happens in this process.
+void fuzz_fork_server();
+
+// counts the edge from the previous instruction to the one at pc, prev
+// holds the hashed previous location
+#define FUZZ_EDGE(prev, pc) do { \
+        uint32_t cur_ = (uint32_t)((pc) * 2654435761u) >> 16; \
+        fuzz_map[(cur_ ^ (prev)) & (FUZZ_MAP_SIZE - 1)]++; \
+        (prev) = cur_ >> 1; \
+    } while(0)
+
+#endif
@@ -0,0 +1,181 @@
+#include "intc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct intc_struct
+{
+    uint32_t vectors[INTC_SOURCES];
+    uint8_t priorities[INTC_SOURCES]; // 0 is the highest
+    uint8_t mask;
+    uint8_t active;
+    // sources in the order they were taken, for nesting
+    uint8_t stack[INTC_SOURCES];
+    uint8_t depth;
+};
+
+intc_t* intc_create()
+{
+    intc_t *intc = malloc(sizeof(*intc));
+    memset(intc, 0, sizeof(*intc));
+    return intc;
+}
+
+void intc_write(intc_t* intc, uint32_t offset, uint8_t val, uint8_t *interrupt_flags)
+{
+    uint32_t n;
+
+    if(offset >= INTC_VECTORS && offset < INTC_VECTORS + INTC_SOURCES * 4)
+    {
+        n = (offset - INTC_VECTORS) / 4;
+        offset = (offset - INTC_VECTORS) % 4 * 8;
+        intc->vectors[n] = (intc->vectors[n] & ~(0xFFu << offset)) | (uint32_t)val << offset;
+    }
+    else if(offset >= INTC_PRIORITIES && offset < INTC_PRIORITIES + INTC_SOURCES)
+    {
+        intc->priorities[offset - INTC_PRIORITIES] = val;
+    }
+    else if(offset == INTC_MASK)
+    {
+        intc->mask = val;
+    }
+    // writing 1 clears a pending source
+    else if(offset == INTC_PENDING)
+    {
+        *interrupt_flags &= ~val;
+    }
+}
+
+uint8_t intc_read(intc_t* intc, uint32_t offset, uint8_t interrupt_flags)
+{
+    uint32_t n;
+
+    if(offset >= INTC_VECTORS && offset < INTC_VECTORS + INTC_SOURCES * 4)
+    {
+        n = (offset - INTC_VECTORS) / 4;
+        return intc->vectors[n] >> ((offset - INTC_VECTORS) % 4 * 8);
+    }
+    if(offset >= INTC_PRIORITIES && offset < INTC_PRIORITIES + INTC_SOURCES)
+    {
+        return intc->priorities[offset - INTC_PRIORITIES];
+    }
+    switch(offset)
+    {
+        case INTC_MASK:
+            return intc->mask;
+        case INTC_PENDING:
+            return interrupt_flags;
+        case INTC_ACTIVE:
+            return intc->active;
+    }
+    return 0;
+}
+
+int intc_enabled(intc_t* intc)
+{
+    return intc->mask != 0;
+}
+
+int intc_take(intc_t* intc, uint8_t *interrupt_flags, uint32_t *vector)
+{
+    uint8_t ready = *interrupt_flags & intc->mask;
+    int n, best = -1;
+
+    if(!intc->mask || !ready)
+    {
+        return 0;
+    }
+
+    // lowest priority value wins, ties go to the lower source number
+    for(n = 0; n < INTC_SOURCES; n++)
+    {
+        if(ready & (1 << n) && (best < 0 || intc->priorities[n] < intc->priorities[best]))
+        {
+            best = n;
+        }
+    }
+
+    // only a higher priority preempts the running handler
+    if(intc->depth && intc->priorities[best] >= intc->priorities[intc->stack[intc->depth - 1]])
+    {
+        return 0;
+    }
+
+    *interrupt_flags &= ~(1 << best);
+    intc->active |= 1 << best;
+    intc->stack[intc->depth++] = best;
+    *vector = intc->vectors[best];
+    return 1;
+}
+
+void intc_return(intc_t* intc)
+{
+    if(intc->depth)
+    {
+        intc->depth--;
+        intc->active &= ~(1 << intc->stack[intc->depth]);
+    }
+}
+
+// vectors (little endian), priorities, mask, active, the nesting stack
+// and its depth
+enum
+{
+    STATE_VECTORS,
+    STATE_PRIORITIES = STATE_VECTORS + INTC_SOURCES * 4,
+    STATE_MASK = STATE_PRIORITIES + INTC_SOURCES,
+    STATE_ACTIVE,
+    STATE_STACK,
+    STATE_DEPTH = STATE_STACK + INTC_SOURCES,
+    STATE_SIZE
+};
+
+size_t intc_state_size()
+{
+    return STATE_SIZE;
+}
+
+void intc_save_state(intc_t* intc, void *buf)
+{
+    uint8_t *state = buf;
+    int n;
+
+    for(n = 0; n < INTC_SOURCES; n++)
+    {
+        state[STATE_VECTORS + n * 4] = intc->vectors[n];
+        state[STATE_VECTORS + n * 4 + 1] = intc->vectors[n] >> 8;
+        state[STATE_VECTORS + n * 4 + 2] = intc->vectors[n] >> 16;
+        state[STATE_VECTORS + n * 4 + 3] = intc->vectors[n] >> 24;
+    }
+    memcpy(state + STATE_PRIORITIES, intc->priorities, INTC_SOURCES);
+    state[STATE_MASK] = intc->mask;
+    state[STATE_ACTIVE] = intc->active;
+    memcpy(state + STATE_STACK, intc->stack, INTC_SOURCES);
+    state[STATE_DEPTH] = intc->depth;
+}
+
+void intc_load_state(intc_t* intc, const void *buf)
+{
+    const uint8_t *state = buf;
+    int n;
+
+    for(n = 0; n < INTC_SOURCES; n++)
+    {
+        intc->vectors[n] = state[STATE_VECTORS + n * 4] | state[STATE_VECTORS + n * 4 + 1] << 8 |
+                           state[STATE_VECTORS + n * 4 + 2] << 16 | (uint32_t)state[STATE_VECTORS + n * 4 + 3] << 24;
+    }
+    memcpy(intc->priorities, state + STATE_PRIORITIES, INTC_SOURCES);
+    intc->mask = state[STATE_MASK];
+    intc->active = state[STATE_ACTIVE];
+    intc->depth = state[STATE_DEPTH] <= INTC_SOURCES ? state[STATE_DEPTH] : INTC_SOURCES;
+    for(n = 0; n < INTC_SOURCES; n++)
+    {
+        intc->stack[n] = state[STATE_STACK + n] % INTC_SOURCES;
+    }
+}
+
+intc_t* intc_free(intc_t* intc)
+{
+    free(intc);
+    return NULL;
+}
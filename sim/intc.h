@@ -0,0 +1,44 @@
+#ifndef INTC_H
+#define INTC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// one source per bit of the interrupt flags
+#define INTC_SOURCES 8
+
+// register offsets from $FF00 0000, see doc/cpu.txt
+#define INTC_VECTORS    0x40 // 4 bytes per source
+#define INTC_PRIORITIES 0x60 // 1 byte per source
+#define INTC_MASK       0x68
+#define INTC_PENDING    0x69
+#define INTC_ACTIVE     0x6A
+
+struct intc_struct;
+typedef struct intc_struct intc_t;
+
+intc_t* intc_create();
+intc_t* intc_free(intc_t* intc);
+
+// offset is relative to $FF00 0000
+void intc_write(intc_t* intc, uint32_t offset, uint8_t val, uint8_t *interrupt_flags);
+uint8_t intc_read(intc_t* intc, uint32_t offset, uint8_t interrupt_flags);
+
+// 0 while the mask is 0 (reset), the core uses the General Interrupt
+// Vector then
+int intc_enabled(intc_t* intc);
+
+// Called by the core before it enters an interrupt. Returns 1 and the
+// vector of the highest priority unmasked pending source, acknowledges it
+// in interrupt_flags and marks it active. Returns 0 if no source is ready
+// or nothing may preempt the active sources.
+int intc_take(intc_t* intc, uint8_t *interrupt_flags, uint32_t *vector);
+
+// Called by the core on RTI, ends the most recent active source.
+void intc_return(intc_t* intc);
+
+size_t intc_state_size();
+void intc_save_state(intc_t* intc, void *buf);
+void intc_load_state(intc_t* intc, const void *buf);
+
+#endif
@@ -0,0 +1,50 @@
+#include "native.h"
+#include "dump.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// the last opcode the interpreter executed, reported with an illegal one
+static uint8_t opcode;
+
+int native_step(cpu_t *cpu, uint32_t pc, uint32_t next)
+{
+    cpu->pc = pc;
+    opcode = cpu_step(cpu);
+    return cpu->pc != next || cpu->status || (cpu->i && cpu->interrupt_flags);
+}
+
+// Runs an image translated by ftrans. Blocks are looked up by pc,
+// interrupts, untranslated code (e.g. RAM code without a listing) and
+// the device poll after NATIVE_POLL translated instructions use the
+// interpreter.
+int main(int argc, char *argv[])
+{
+    cpu_t *cpu = cpu_create();
+    native_block_t block;
+
+    memcpy(cpu->flash, native_image, native_image_size);
+
+    dump_flash_head(cpu, 160);
+
+    while(!cpu->status)
+    {
+        if ((cpu->i && cpu->interrupt_flags) || cpu->fused_clocks > NATIVE_POLL ||
+            !(block = native_lookup(cpu->pc)))
+        {
+            opcode = cpu_step(cpu);
+        }
+        else
+        {
+            block(cpu);
+        }
+    }
+
+    dump_exit(cpu, opcode);
+
+    cpu = cpu_free(cpu);
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+#define NATIVE_RAM_END   0x01000000u
+#define NATIVE_FLASH_END 0x02000000u
+
+// longer straight code is split, the dispatcher gets control back
+#define NATIVE_MAX_BLOCK 64
+
+// The blocks count their instructions in fused_clocks, the next cpu_step
+// adds them to the retired instructions and clocks the peripherals with
+// them. The dispatcher steps before a block could overflow it.
+#define NATIVE_POLL (255 - NATIVE_MAX_BLOCK)
+
+// the lazy flags as the core sets them, see cpu.h
+#define NATIVE_SET_Z(r)       cpu->z_value = (r)
+#define NATIVE_SET_ZN(r)      cpu->z_value = (r); cpu->n_lhs = 0x7FFFFFFF; cpu->n_rhs = cpu->z_value
+#define NATIVE_SET_CMP(v, a)  cpu->z_value = (v) ^ (a); cpu->n_lhs = (v); cpu->n_rhs = (a)
+#define NATIVE_SET_STEP(r, o) cpu->z_value = (r); cpu->n_lhs = (r); cpu->n_rhs = (o)
+#define NATIVE_Z (cpu->z_value == 0)
+#define NATIVE_N (cpu->n_lhs < cpu->n_rhs)
+
+// a translated basic block, runs until the block ends and leaves the
+// next pc in cpu->pc
+typedef void (*native_block_t)(cpu_t *cpu);
+
+// provided by the file ftrans generates
+extern const uint8_t native_image[];
+extern const uint32_t native_image_size;
+native_block_t native_lookup(uint32_t pc);
+
+// Executes the instruction at pc in the interpreter, for everything the
+// blocks do not inline (peripherals, HLT, RTI, ...). The core counts it,
+// the block does not. Returns 1 if the block has to end: the pc is not
+// next, the cpu stopped or an interrupt is pending.
+int native_step(cpu_t *cpu, uint32_t pc, uint32_t next);
+
+// n bytes at a lie in ram or in flash, without side effects
+static inline int native_mem(uint32_t a, uint32_t n)
+{
+    return a <= NATIVE_RAM_END - n || (a >= NATIVE_RAM_END && a <= NATIVE_FLASH_END - n);
+}
+
+// only ram is written inline, the core decides about flash
+static inline int native_ram(uint32_t a, uint32_t n)
+{
+    return a <= NATIVE_RAM_END - n;
+}
+
+static inline uint8_t* native_ptr(cpu_t *cpu, uint32_t a)
+{
+    return a < NATIVE_RAM_END ? cpu->ram + a : cpu->flash + (a - NATIVE_RAM_END);
+}
+
+static inline uint32_t native_rd32(cpu_t *cpu, uint32_t a)
+{
+    const uint8_t *p = native_ptr(cpu, a);
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void native_wr32(cpu_t *cpu, uint32_t a, uint32_t v)
+{
+    uint8_t *p = cpu->ram + a;
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+// ($p,X): the address is the word at p + X
+static inline int native_ea_ix(cpu_t *cpu, uint32_t p, uint32_t *ea)
+{
+    if (!native_mem(p + cpu->x, 4))
+    {
+        return 0;
+    }
+    *ea = native_rd32(cpu, p + cpu->x);
+    return 1;
+}
+
+// ($p),X: the address is the word at p plus X
+static inline int native_ea_io(cpu_t *cpu, uint32_t p, uint32_t *ea)
+{
+    if (!native_mem(p, 4))
+    {
+        return 0;
+    }
+    *ea = native_rd32(cpu, p) + cpu->x;
+    return 1;
+}
+
+#endif
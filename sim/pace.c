@@ -0,0 +1,96 @@
+#include "pace.h"
+
+#include <stdio.h>
+
+#ifdef __MINGW32__
+#include <windows.h>
+
+static double now()
+{
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double)count.QuadPart / freq.QuadPart;
+}
+
+static void sleep_for(double seconds)
+{
+    Sleep((DWORD)(seconds * 1000));
+}
+#else
+#include <time.h>
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_for(double seconds)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+#endif
+
+void pace_init(pace_t *pace, double rate)
+{
+    pace->rate = rate;
+    pace->quantum = rate / PACE_QUANTA_PER_SECOND;
+    if(pace->quantum == 0)
+    {
+        pace->quantum = 1;
+    }
+    pace->instructions = 0;
+    pace->start = now();
+    pace->quanta = 0;
+    pace->late = 0;
+    pace->max_lag = 0;
+    pace->slept = 0;
+}
+
+void pace_quantum(pace_t *pace, uint32_t executed)
+{
+    double ahead;
+
+    pace->instructions += executed;
+    pace->quanta++;
+
+    // the target time is absolute, a late quantum is made up by
+    // sleeping less after the following ones
+    ahead = pace->start + pace->instructions / pace->rate - now();
+    if(ahead > 0)
+    {
+        sleep_for(ahead);
+        pace->slept += ahead;
+    }
+    else
+    {
+        pace->late++;
+        if(-ahead > pace->max_lag)
+        {
+            pace->max_lag = -ahead;
+        }
+    }
+}
+
+void pace_report(pace_t *pace)
+{
+    double elapsed = now() - pace->start;
+    double target = pace->instructions / pace->rate;
+
+    puts("Pacing:");
+    printf("target rate  = %.0f instr/s\n", pace->rate);
+    printf("actual rate  = %.0f instr/s\n", elapsed > 0 ? pace->instructions / elapsed : 0);
+    printf("quanta       = %u (%u late)\n", pace->quanta, pace->late);
+    printf("max lag      = %.3f ms\n", pace->max_lag * 1000);
+    printf("drift        = %.3f ms\n", (elapsed - target) * 1000);
+    printf("slept        = %.3f s of %.3f s\n", pace->slept, elapsed);
+    puts("");
+}
@@ -0,0 +1,29 @@
+#ifndef PACE_H
+#define PACE_H
+
+#include <stdint.h>
+
+// instructions per sleep quantum are chosen for this many quanta per second
+#define PACE_QUANTA_PER_SECOND 100
+
+typedef struct
+{
+    double rate;            // target instructions per second
+    uint32_t quantum;       // instructions between two sleeps
+    uint64_t instructions;
+    double start;
+    uint32_t quanta;
+    uint32_t late;          // quanta that ended behind the target time
+    double max_lag;
+    double slept;
+} pace_t;
+
+void pace_init(pace_t *pace, double rate);
+
+// called after each quantum, sleeps until the target time of the
+// instructions executed so far
+void pace_quantum(pace_t *pace, uint32_t executed);
+
+void pace_report(pace_t *pace);
+
+#endif
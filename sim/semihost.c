@@ -0,0 +1,162 @@
+#include "semihost.h"
+#include "watch.h"
+
+#include <stdio.h>
+
+static FILE *files[SEMIHOST_FILES];
+
+// host pointer to len bytes of guest ram or flash, NULL if the range
+// leaves the memory it starts in
+static uint8_t* guest_ptr(cpu_t *cpu, uint32_t addr, uint32_t len, int writable)
+{
+    if(addr < sizeof(cpu->ram))
+    {
+        return len <= sizeof(cpu->ram) - addr ? cpu->ram + addr : NULL;
+    }
+    addr -= sizeof(cpu->ram);
+    if(!writable && addr < sizeof(cpu->flash))
+    {
+        return len <= sizeof(cpu->flash) - addr ? cpu->flash + addr : NULL;
+    }
+    return NULL;
+}
+
+static uint32_t read_word(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void write_word(uint8_t *p, uint32_t val)
+{
+    p[0] = val;
+    p[1] = val >> 8;
+    p[2] = val >> 16;
+    p[3] = val >> 24;
+}
+
+static uint32_t semihost_open(cpu_t *cpu, uint32_t path, const char *mode)
+{
+    uint8_t *name = guest_ptr(cpu, path, 1, 0);
+    uint32_t handle, len;
+
+    // path must be terminated inside guest memory
+    for(len = 0; name && name[len]; len++)
+    {
+        if(len == 255 || !guest_ptr(cpu, path, len + 2, 0))
+        {
+            return SEMIHOST_ERROR;
+        }
+    }
+    if(!name)
+    {
+        return SEMIHOST_ERROR;
+    }
+    watch_host_access(path, len + 1, 0);
+
+    for(handle = 0; handle < SEMIHOST_FILES; handle++)
+    {
+        if(!files[handle])
+        {
+            files[handle] = fopen((char*)name, mode);
+            return files[handle] ? handle : SEMIHOST_ERROR;
+        }
+    }
+    return SEMIHOST_ERROR;
+}
+
+// Guest memory is copied with watchpoints suspended, the kernel fails on
+// protected buffers instead of faulting. The accesses are reported as
+// hits of the instruction that wrote the request.
+uint32_t semihost_request(cpu_t *cpu, uint32_t block)
+{
+    uint8_t *req = guest_ptr(cpu, block, 20, 1);
+    uint32_t op, handle, buffer, length, result = SEMIHOST_ERROR;
+    uint8_t *data;
+    FILE *file = NULL;
+    long pos;
+
+    if(!req)
+    {
+        return SEMIHOST_ERROR;
+    }
+
+    watch_suspend();
+    watch_host_access(block, 16, 0);
+    op = read_word(req);
+    handle = read_word(req + 4);
+    buffer = read_word(req + 8);
+    length = read_word(req + 12);
+
+    if(handle < SEMIHOST_FILES)
+    {
+        file = files[handle];
+    }
+
+    switch(op)
+    {
+        case SEMIHOST_OPEN_READ:
+            result = semihost_open(cpu, buffer, "rb");
+            break;
+
+        case SEMIHOST_OPEN_WRITE:
+            result = semihost_open(cpu, buffer, "wb");
+            break;
+
+        // bulk copy straight between the host file and guest memory
+        case SEMIHOST_READ:
+            data = guest_ptr(cpu, buffer, length, 1);
+            if(file && data)
+            {
+                watch_host_access(buffer, length, 1);
+                result = fread(data, 1, length, file);
+            }
+            break;
+
+        case SEMIHOST_WRITE:
+            data = guest_ptr(cpu, buffer, length, 0);
+            if(file && data)
+            {
+                watch_host_access(buffer, length, 0);
+                result = fwrite(data, 1, length, file);
+            }
+            break;
+
+        case SEMIHOST_CLOSE:
+            if(file)
+            {
+                fclose(file);
+                files[handle] = NULL;
+                result = 0;
+            }
+            break;
+
+        case SEMIHOST_SIZE:
+            if(file)
+            {
+                pos = ftell(file);
+                fseek(file, 0, SEEK_END);
+                result = ftell(file);
+                fseek(file, pos, SEEK_SET);
+            }
+            break;
+    }
+
+    watch_host_access(block + 16, 4, 1);
+    write_word(req + 16, result);
+    watch_resume();
+    return result;
+}
+
+void semihost_close_all()
+{
+    int handle;
+
+    for(handle = 0; handle < SEMIHOST_FILES; handle++)
+    {
+        if(files[handle])
+        {
+            fclose(files[handle]);
+            files[handle] = NULL;
+        }
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef SEMIHOST_H
+#define SEMIHOST_H
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+#define SEMIHOST_FILES 16
+
+#define SEMIHOST_OPEN_READ  1
+#define SEMIHOST_OPEN_WRITE 2
+#define SEMIHOST_READ       3
+#define SEMIHOST_WRITE      4
+#define SEMIHOST_CLOSE      5
+#define SEMIHOST_SIZE       6
+
+#define SEMIHOST_ERROR 0xFFFFFFFF
+
+// Executes the request block at guest address block, see doc/cpu.txt.
+// The core calls this on a word write to the Semihosting Request
+// register. The result is also stored in the block.
+uint32_t semihost_request(cpu_t *cpu, uint32_t block);
+
+void semihost_close_all();
+
+#endif
@@ -0,0 +1,47 @@
+#include "smp.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+static pthread_t threads[CPU_MAX_CORES];
+static int running;
+
+static void* run_core(void *arg)
+{
+    cpu_t *cpu = arg;
+
+    while(__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        // a halted core waits for the next start
+        if(__atomic_load_n(&cpu->status, __ATOMIC_ACQUIRE))
+        {
+            usleep(100);
+            continue;
+        }
+        cpu_step(cpu);
+    }
+    return NULL;
+}
+
+void smp_start(cpu_t *cpu, int count)
+{
+    int i;
+
+    cpu_add_cores(cpu, count);
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    for(i = 1; i < cpu->core_count; i++)
+    {
+        pthread_create(&threads[i], NULL, run_core, cpu->cores[i]);
+    }
+}
+
+void smp_stop(cpu_t *cpu)
+{
+    int i;
+
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    for(i = 1; i < cpu->core_count; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "cpu.h"
+
+// Adds cores to the machine until it has count cores and runs every
+// other core than core 0 in a thread of its own. The caller keeps
+// stepping core 0, the other cores stay halted until core 0 writes the
+// Core Start Address.
+void smp_start(cpu_t *cpu, int count);
+// stops and joins the threads of the other cores
+void smp_stop(cpu_t *cpu);
+
+#endif
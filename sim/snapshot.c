@@ -0,0 +1,259 @@
+#include "snapshot.h"
+#include "intc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __MINGW32__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// File layout:
+//   header
+//   uart state (uart_size bytes)
+//   interrupt controller state (intc_size bytes)
+//   page index, one uint32_t per page, bit 31 set for flash pages
+//   padding up to the next SNAPSHOT_PAGE_SIZE boundary
+//   page data, SNAPSHOT_PAGE_SIZE bytes per page
+// Everything is stored in host byte order, a snapshot is meant to be read
+// back by the same fsim build.
+
+#define SNAPSHOT_MAGIC 0x504e5346 // "FSNP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_FLASH_PAGE (1u<<31)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t image_hash;
+    uint32_t a, x, pc, sp;
+    uint32_t interrupt_vector;
+    // Z, N, I and C as PUF pushes them
+    uint32_t flags;
+    uint8_t interrupt_flags;
+    uint32_t uart_size;
+    uint32_t intc_size;
+    uint32_t pages;
+} snapshot_header_t;
+
+// FNV-1a, ties a snapshot to the flash image it was taken from
+static uint32_t hash_image(const uint8_t *image, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for(i = 0; i < size; i++)
+    {
+        hash = (hash ^ image[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static size_t data_offset(const snapshot_header_t *header)
+{
+    size_t offset = sizeof(snapshot_header_t) + header->uart_size + header->intc_size + header->pages * sizeof(uint32_t);
+
+    return (offset + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE * SNAPSHOT_PAGE_SIZE;
+}
+
+int snapshot_save(cpu_t *cpu, const uint8_t *flash_image, const char *filename)
+{
+    static const uint8_t zero_page[SNAPSHOT_PAGE_SIZE];
+    const uint32_t ram_pages = sizeof(cpu->ram) / SNAPSHOT_PAGE_SIZE;
+    const uint32_t flash_pages = sizeof(cpu->flash) / SNAPSHOT_PAGE_SIZE;
+    snapshot_header_t header;
+    uint32_t *index = malloc((ram_pages + flash_pages) * sizeof(uint32_t));
+    uint8_t *uart_state = malloc(uart_state_size());
+    uint8_t *intc_state = malloc(intc_state_size());
+    const uint8_t *page;
+    uint32_t p, n = 0;
+    size_t pos;
+    FILE *file = NULL;
+
+    for(p = 0; p < ram_pages; p++)
+    {
+        if(memcmp(cpu->ram + p * SNAPSHOT_PAGE_SIZE, zero_page, SNAPSHOT_PAGE_SIZE) != 0)
+        {
+            index[n++] = p;
+        }
+    }
+    for(p = 0; p < flash_pages; p++)
+    {
+        if(memcmp(cpu->flash + p * SNAPSHOT_PAGE_SIZE, flash_image + p * SNAPSHOT_PAGE_SIZE, SNAPSHOT_PAGE_SIZE) != 0)
+        {
+            index[n++] = p | SNAPSHOT_FLASH_PAGE;
+        }
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.image_hash = hash_image(flash_image, sizeof(cpu->flash));
+    header.a = cpu->a;
+    header.x = cpu->x;
+    header.pc = cpu->pc;
+    header.sp = cpu->sp;
+    header.interrupt_vector = cpu->interrupt_vector;
+    header.flags = cpu_flags(cpu);
+    header.interrupt_flags = cpu->interrupt_flags;
+    header.uart_size = uart_state_size();
+    header.intc_size = intc_state_size();
+    header.pages = n;
+    uart_save_state(cpu->uart, uart_state);
+    intc_save_state(cpu->intc, intc_state);
+
+    file = fopen(filename, "wb");
+    if(!file)
+    {
+        printf("could not create snapshot file \"%s\"\n", filename);
+        free(index);
+        free(uart_state);
+        free(intc_state);
+        return -1;
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(uart_state, header.uart_size, 1, file);
+    fwrite(intc_state, header.intc_size, 1, file);
+    fwrite(index, sizeof(uint32_t), n, file);
+    for(pos = ftell(file); pos < data_offset(&header); pos++)
+    {
+        fputc(0, file);
+    }
+    for(p = 0; p < n; p++)
+    {
+        if(index[p] & SNAPSHOT_FLASH_PAGE)
+        {
+            page = cpu->flash + (index[p] & ~SNAPSHOT_FLASH_PAGE) * SNAPSHOT_PAGE_SIZE;
+        }
+        else
+        {
+            page = cpu->ram + index[p] * SNAPSHOT_PAGE_SIZE;
+        }
+        fwrite(page, SNAPSHOT_PAGE_SIZE, 1, file);
+    }
+
+    fclose(file);
+    free(index);
+    free(uart_state);
+    free(intc_state);
+    printf("Saved snapshot with %u pages to \"%s\"\n", n, filename);
+    return 0;
+}
+
+static int apply_snapshot(cpu_t *cpu, const uint8_t *base, size_t size, const char *filename)
+{
+    const uint32_t ram_pages = sizeof(cpu->ram) / SNAPSHOT_PAGE_SIZE;
+    const uint32_t flash_pages = sizeof(cpu->flash) / SNAPSHOT_PAGE_SIZE;
+    const snapshot_header_t *header;
+    const uint32_t *index;
+    const uint8_t *data;
+    uint32_t p, page;
+
+    header = (const snapshot_header_t*)base;
+    if(size < sizeof(*header) || header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION)
+    {
+        printf("\"%s\" is not a snapshot\n", filename);
+        return -1;
+    }
+    if(header->uart_size != uart_state_size() || header->intc_size != intc_state_size() ||
+       size < data_offset(header) + (size_t)header->pages * SNAPSHOT_PAGE_SIZE)
+    {
+        printf("snapshot \"%s\" is truncated or from another build\n", filename);
+        return -1;
+    }
+    if(header->image_hash != hash_image(cpu->flash, sizeof(cpu->flash)))
+    {
+        printf("snapshot \"%s\" was taken from another flash image\n", filename);
+        return -1;
+    }
+
+    index = (const uint32_t*)(base + sizeof(*header) + header->uart_size + header->intc_size);
+    data = base + data_offset(header);
+    for(p = 0; p < header->pages; p++, data += SNAPSHOT_PAGE_SIZE)
+    {
+        page = index[p] & ~SNAPSHOT_FLASH_PAGE;
+        if(index[p] & SNAPSHOT_FLASH_PAGE && page < flash_pages)
+        {
+            memcpy(cpu->flash + page * SNAPSHOT_PAGE_SIZE, data, SNAPSHOT_PAGE_SIZE);
+        }
+        else if(!(index[p] & SNAPSHOT_FLASH_PAGE) && page < ram_pages)
+        {
+            memcpy(cpu->ram + page * SNAPSHOT_PAGE_SIZE, data, SNAPSHOT_PAGE_SIZE);
+        }
+    }
+
+    cpu->a = header->a;
+    cpu->x = header->x;
+    cpu->pc = header->pc;
+    cpu->sp = header->sp;
+    cpu->interrupt_vector = header->interrupt_vector;
+    cpu_set_flags(cpu, header->flags);
+    cpu->interrupt_flags = header->interrupt_flags;
+    uart_load_state(cpu->uart, base + sizeof(*header));
+    intc_load_state(cpu->intc, base + sizeof(*header) + header->uart_size);
+
+    printf("Loaded snapshot with %u pages from \"%s\"\n", header->pages, filename);
+    return 0;
+}
+
+int snapshot_load(cpu_t *cpu, const char *filename)
+{
+    uint8_t *base = NULL;
+    size_t size;
+    int ret;
+#ifdef __MINGW32__
+    FILE *file = fopen(filename, "rb");
+
+    if(!file)
+    {
+        printf("could not open snapshot file \"%s\"\n", filename);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    base = malloc(size);
+    if(fread(base, 1, size, file) != size)
+    {
+        size = 0;
+    }
+    fclose(file);
+#else
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    if(fd < 0 || fstat(fd, &st) != 0)
+    {
+        printf("could not open snapshot file \"%s\"\n", filename);
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    size = st.st_size;
+    // pages are only touched when copied into the cpu
+    base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+    {
+        printf("could not map snapshot file \"%s\"\n", filename);
+        return -1;
+    }
+#endif
+
+    ret = apply_snapshot(cpu, base, size, filename);
+
+#ifdef __MINGW32__
+    free(base);
+#else
+    munmap(base, size);
+#endif
+    return ret;
+}
@@ -0,0 +1,20 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "cpu.h"
+
+#include <stdint.h>
+
+#define SNAPSHOT_PAGE_SIZE 4096
+
+// Saves registers, flags, interrupt state, uart and interrupt controller
+// state, every ram page that is not zero and every flash page that
+// differs from flash_image, the flash contents the machine booted from.
+// Returns 0 on success.
+int snapshot_save(cpu_t *cpu, const uint8_t *flash_image, const char *filename);
+
+// Restores a snapshot on top of a freshly created cpu whose flash holds the
+// boot image the snapshot was taken from. Returns 0 on success.
+int snapshot_load(cpu_t *cpu, const char *filename);
+
+#endif
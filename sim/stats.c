@@ -0,0 +1,108 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+volatile sig_atomic_t stats_dump_requested = 0;
+
+#ifdef __MINGW32__
+#include <windows.h>
+
+static double wall_time()
+{
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (double)count.QuadPart / freq.QuadPart;
+}
+#else
+static double wall_time()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+#ifdef SIGUSR1
+static void dump_handler(int sig)
+{
+    stats_dump_requested = 1;
+}
+#endif
+
+void stats_init(stats_t *stats, cpu_t *cpu)
+{
+    memset(stats, 0, sizeof(*stats));
+    cpu->io_reads = stats->io_reads;
+    cpu->io_writes = stats->io_writes;
+    stats->start_wall = wall_time();
+    stats->start_cpu = clock();
+#ifdef SIGUSR1
+    signal(SIGUSR1, dump_handler);
+#endif
+}
+
+void stats_write(stats_t *stats, cpu_t *cpu, const char *filename)
+{
+    FILE *file = filename ? fopen(filename, "w") : stdout;
+    double wall = wall_time() - stats->start_wall;
+    double cpu_time = (double)(clock() - stats->start_cpu) / CLOCKS_PER_SEC;
+    uint64_t instructions = 0;
+    int op, reg, first = 1;
+
+    if(!file)
+    {
+        printf("could not open stats file \"%s\"\n", filename);
+        return;
+    }
+
+    for(op = 0; op < 256; op++)
+    {
+        instructions += stats->opcodes[op];
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"instructions\": %llu,\n", (unsigned long long)instructions);
+    fprintf(file, "  \"wall_seconds\": %.6f,\n", wall);
+    fprintf(file, "  \"cpu_seconds\": %.6f,\n", cpu_time);
+    fprintf(file, "  \"mips\": %.3f,\n", wall > 0 ? instructions / wall / 1e6 : 0);
+    fprintf(file, "  \"interrupts\": %llu,\n", (unsigned long long)cpu->interrupts);
+    fprintf(file, "  \"uart\": { \"bytes_sent\": %u, \"bytes_received\": %u },\n",
+            uart_bytes_sent(cpu->uart), uart_bytes_received(cpu->uart));
+    fprintf(file, "  \"status\": %d,\n", cpu->status);
+    fprintf(file, "  \"pc\": \"%08x\",\n", cpu->pc);
+    fprintf(file, "  \"opcodes\": {");
+    for(op = 0; op < 256; op++)
+    {
+        if(stats->opcodes[op])
+        {
+            fprintf(file, "%s\n    \"%02x\": %llu", first ? "" : ",", op, (unsigned long long)stats->opcodes[op]);
+            first = 0;
+        }
+    }
+    fprintf(file, "\n  },\n");
+    fprintf(file, "  \"mmio\": {");
+    first = 1;
+    for(reg = 0; reg < 256; reg++)
+    {
+        if(stats->io_reads[reg] || stats->io_writes[reg])
+        {
+            fprintf(file, "%s\n    \"%08x\": { \"reads\": %llu, \"writes\": %llu }", first ? "" : ",",
+                    CPU_IO_START + reg, (unsigned long long)stats->io_reads[reg], (unsigned long long)stats->io_writes[reg]);
+            first = 0;
+        }
+    }
+    fprintf(file, "\n  }\n}\n");
+
+    if(filename)
+    {
+        fclose(file);
+    }
+    else
+    {
+        fflush(file);
+    }
+}
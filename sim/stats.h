@@ -0,0 +1,29 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "cpu.h"
+
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct
+{
+    uint64_t opcodes[256];
+    // per register, the offset from CPU_IO_START
+    uint64_t io_reads[256];
+    uint64_t io_writes[256];
+    double start_wall;
+    clock_t start_cpu;
+} stats_t;
+
+// set by SIGUSR1, fsim writes the statistics at the next instruction
+extern volatile sig_atomic_t stats_dump_requested;
+
+// starts the clocks and lets the cpu count its register accesses
+void stats_init(stats_t *stats, cpu_t *cpu);
+
+// writes the statistics as JSON, to stdout if filename is NULL
+void stats_write(stats_t *stats, cpu_t *cpu, const char *filename);
+
+#endif
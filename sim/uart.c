@@ -51,18 +51,72 @@ static int getch()
 }
 #endif
 
+typedef struct
+{
+    uint8_t data[UART_FIFO_DEPTH];
+    uint8_t head;
+    uint8_t count;
+} uart_fifo_t;
+
 struct uart_sturct
 {
     uint8_t status;
     uint8_t control;
-    uint8_t recv;
-    uint8_t recv_empty;
+    uint8_t baudrate;
+    uint8_t rx_threshold;
+    uint8_t tx_threshold;
+    uart_fifo_t rx;
+    uart_fifo_t tx;
+    // clocks since the start and when the shift registers take their
+    // next byte
+    uint64_t clock;
+    uint64_t rx_next;
+    uint64_t tx_next;
+    // replaces the keyboard if set
+    const uint8_t *input;
+    size_t input_len;
+    size_t input_pos;
+    uint32_t bytes_sent;
+    uint32_t bytes_received;
 };
 
+// a byte is 10 bits of 16 ticks, a tick is baudrate + 1 clocks
+static uint32_t byte_clocks(uart_t* uart)
+{
+    return 160 * (uart->baudrate + 1u);
+}
+
+static int fifo_push(uart_fifo_t *fifo, uint8_t val)
+{
+    if(fifo->count == UART_FIFO_DEPTH)
+    {
+        return 0;
+    }
+    fifo->data[(fifo->head + fifo->count) % UART_FIFO_DEPTH] = val;
+    fifo->count++;
+    return 1;
+}
+
+static uint8_t fifo_pop(uart_fifo_t *fifo)
+{
+    uint8_t val = 0;
+
+    if(fifo->count)
+    {
+        val = fifo->data[fifo->head];
+        fifo->head = (fifo->head + 1) % UART_FIFO_DEPTH;
+        fifo->count--;
+    }
+    return val;
+}
+
 uart_t* uart_create()
 {
     uart_t *uart = malloc(sizeof(*uart));
     memset(uart,0,sizeof(*uart));
+    uart->rx_threshold = 1;
+    // 115200 baud at 50 MHz, like the FPGA
+    uart->baudrate = 26;
     return uart;
 }
 
@@ -71,9 +125,11 @@ void uart_write_send(uart_t* uart, uint8_t val)
     // uart tx enabled
     if(uart->control & (1<<3))
     {
-        putc(val, stdout);
-        fflush(stdout);
-        uart->status |= (1<<1);
+        // tx fifo full
+        if(!fifo_push(&uart->tx, val))
+        {
+            uart->status |= (1<<2);
+        }
     }
 }
 
@@ -82,44 +138,112 @@ void uart_write_control(uart_t* uart, uint8_t val)
     uart->control = val;
 }
 
+void uart_write_baudrate(uart_t* uart, uint8_t val)
+{
+    uart->baudrate = val;
+}
+
+void uart_write_rx_threshold(uart_t* uart, uint8_t val)
+{
+    // an empty fifo never raises the rx interrupt
+    uart->rx_threshold = val ? val : 1;
+}
+
+void uart_write_tx_threshold(uart_t* uart, uint8_t val)
+{
+    uart->tx_threshold = val;
+}
+
 uint8_t uart_read_status(uart_t* uart)
 {
-    const uint8_t status = uart->status;
+    uint8_t status = uart->status;
+
+    // receive/transmit complete follow the fifos, errors reset on read
+    if(uart->rx.count)
+    {
+        status |= (1<<0);
+    }
+    if(!uart->tx.count)
+    {
+        status |= (1<<1);
+    }
     uart->status = 0;
     return status;
 }
 
 uint8_t uart_read_recv(uart_t* uart)
 {
-    // reset receive complete
-    uart->status &= ~(1<<0);
-    uart->recv_empty = 1;
-    return uart->recv;
+    return fifo_pop(&uart->rx);
 }
 
-int uart_recv_loop(uart_t* uart, uint8_t *interrupt_flags)
+uint8_t uart_read_rx_level(uart_t* uart)
 {
-    // uart rx enabled and keyboard hit
-    if(uart->control & (1<<0) &&  kbhit())
+    return uart->rx.count;
+}
+
+uint8_t uart_read_tx_level(uart_t* uart)
+{
+    return uart->tx.count;
+}
+
+uint8_t uart_read_fifo_depth(uart_t* uart)
+{
+    return UART_FIFO_DEPTH;
+}
+
+int uart_recv_loop(uart_t* uart, uint8_t *interrupt_flags, uint32_t clocks)
+{
+    uart->clock += clocks;
+
+    // the transmitter takes the next byte when the last one is out
+    if(uart->tx.count && uart->clock >= uart->tx_next)
     {
-        uart->recv = getch();
-        uart->status |= (1<<0);
+        putc(fifo_pop(&uart->tx), stdout);
+        uart->bytes_sent++;
+        fflush(stdout);
+        uart->tx_next = uart->clock + byte_clocks(uart);
+    }
 
-        // data over run error
-        if(!uart->recv_empty)
+    // the receiver looks for a byte once per byte time
+    if(uart->clock >= uart->rx_next)
+    {
+        uart->rx_next = uart->clock + byte_clocks(uart);
+
+        // input buffer is flow controlled, nothing is lost
+        if(uart->input)
         {
-            uart->status |= (1<<2) | (1<<3);
+            if(uart->control & (1<<2) && uart->input_pos < uart->input_len)
+            {
+                if(fifo_push(&uart->rx, uart->input[uart->input_pos]))
+                {
+                    uart->input_pos++;
+                    uart->bytes_received++;
+                }
+            }
         }
-
-        // rx interrupt enabled
-        if(uart->control & (1<<0))
+        // receiver enabled and keyboard hit
+        else if(uart->control & (1<<2) && kbhit())
         {
-            *interrupt_flags |= (1<<0);
+            // data over run error, byte is lost
+            if(!fifo_push(&uart->rx, getch()))
+            {
+                uart->status |= (1<<2) | (1<<3);
+            }
+            else
+            {
+                uart->bytes_received++;
+            }
         }
     }
 
-    // tx interrupt enabled and tx completed
-    if(uart->control & (1<<1) && uart->status & (1<<1))
+    // rx interrupt enabled and rx fifo at threshold
+    if(uart->control & (1<<0) && uart->rx.count >= uart->rx_threshold)
+    {
+        *interrupt_flags |= (1<<0);
+    }
+
+    // tx interrupt enabled and tx fifo drained to threshold
+    if(uart->control & (1<<1) && uart->tx.count <= uart->tx_threshold)
     {
         *interrupt_flags |= (1<<0);
     }
@@ -127,6 +251,79 @@ int uart_recv_loop(uart_t* uart, uint8_t *interrupt_flags)
     return (*interrupt_flags &(1<<0)) != 0;
 }
 
+uint32_t uart_bytes_sent(uart_t* uart)
+{
+    return uart->bytes_sent;
+}
+
+uint32_t uart_bytes_received(uart_t* uart)
+{
+    return uart->bytes_received;
+}
+
+void uart_set_input(uart_t* uart, const uint8_t *data, size_t len)
+{
+    uart->input = data;
+    uart->input_len = len;
+    uart->input_pos = 0;
+}
+
+// the guest visible state: status, control, thresholds and both fifos.
+// The input buffer belongs to the host process and is not saved.
+enum
+{
+    STATE_STATUS,
+    STATE_CONTROL,
+    STATE_RX_THRESHOLD,
+    STATE_TX_THRESHOLD,
+    STATE_RX_HEAD,
+    STATE_RX_COUNT,
+    STATE_TX_HEAD,
+    STATE_TX_COUNT,
+    STATE_RX_DATA,
+    STATE_TX_DATA = STATE_RX_DATA + UART_FIFO_DEPTH,
+    STATE_SIZE = STATE_TX_DATA + UART_FIFO_DEPTH
+};
+
+size_t uart_state_size()
+{
+    return STATE_SIZE;
+}
+
+void uart_save_state(uart_t* uart, void *buf)
+{
+    uint8_t *state = buf;
+
+    state[STATE_STATUS] = uart->status;
+    state[STATE_CONTROL] = uart->control;
+    state[STATE_RX_THRESHOLD] = uart->rx_threshold;
+    state[STATE_TX_THRESHOLD] = uart->tx_threshold;
+    state[STATE_RX_HEAD] = uart->rx.head;
+    state[STATE_RX_COUNT] = uart->rx.count;
+    state[STATE_TX_HEAD] = uart->tx.head;
+    state[STATE_TX_COUNT] = uart->tx.count;
+    memcpy(state + STATE_RX_DATA, uart->rx.data, UART_FIFO_DEPTH);
+    memcpy(state + STATE_TX_DATA, uart->tx.data, UART_FIFO_DEPTH);
+}
+
+// the input falls back to the keyboard until uart_set_input is called again
+void uart_load_state(uart_t* uart, const void *buf)
+{
+    const uint8_t *state = buf;
+
+    uart->status = state[STATE_STATUS];
+    uart->control = state[STATE_CONTROL];
+    uart->rx_threshold = state[STATE_RX_THRESHOLD];
+    uart->tx_threshold = state[STATE_TX_THRESHOLD];
+    uart->rx.head = state[STATE_RX_HEAD] % UART_FIFO_DEPTH;
+    uart->rx.count = state[STATE_RX_COUNT] <= UART_FIFO_DEPTH ? state[STATE_RX_COUNT] : UART_FIFO_DEPTH;
+    uart->tx.head = state[STATE_TX_HEAD] % UART_FIFO_DEPTH;
+    uart->tx.count = state[STATE_TX_COUNT] <= UART_FIFO_DEPTH ? state[STATE_TX_COUNT] : UART_FIFO_DEPTH;
+    memcpy(uart->rx.data, state + STATE_RX_DATA, UART_FIFO_DEPTH);
+    memcpy(uart->tx.data, state + STATE_TX_DATA, UART_FIFO_DEPTH);
+    uart_set_input(uart, NULL, 0);
+}
+
 uart_t* uart_free(uart_t* uart)
 {
     free(uart);
@@ -2,6 +2,12 @@
 #define UART_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+// read back by the guest from UART FIFO Depth, at most 255
+#ifndef UART_FIFO_DEPTH
+#define UART_FIFO_DEPTH 16
+#endif
 
 struct uart_sturct;
 typedef struct uart_sturct uart_t;
@@ -11,11 +17,29 @@ uart_t* uart_free(uart_t* uart);
 
 void uart_write_send(uart_t* uart, uint8_t val);
 void uart_write_control(uart_t* uart, uint8_t val);
+void uart_write_baudrate(uart_t* uart, uint8_t val);
+void uart_write_rx_threshold(uart_t* uart, uint8_t val);
+void uart_write_tx_threshold(uart_t* uart, uint8_t val);
 
 uint8_t uart_read_status(uart_t* uart);
 uint8_t uart_read_recv(uart_t* uart);
+uint8_t uart_read_rx_level(uart_t* uart);
+uint8_t uart_read_tx_level(uart_t* uart);
+uint8_t uart_read_fifo_depth(uart_t* uart);
+
+// advances the uart by clocks cycles of the cpu clock, a byte takes
+// 160 * (baudrate + 1) clocks to shift in or out
+int uart_recv_loop(uart_t* uart, uint8_t *interrupt_flags, uint32_t clocks);
+
+uint32_t uart_bytes_sent(uart_t* uart);
+uint32_t uart_bytes_received(uart_t* uart);
+
+// receive data from a buffer instead of the keyboard
+void uart_set_input(uart_t* uart, const uint8_t *data, size_t len);
 
-int uart_recv_loop(uart_t* uart, uint8_t *interrupt_flags);
+size_t uart_state_size();
+void uart_save_state(uart_t* uart, void *buf);
+void uart_load_state(uart_t* uart, const void *buf);
 
 /*
 int main()
@@ -29,7 +53,7 @@ int main()
     
     for(;;)
     {
-        uart_recv_loop(uart, &interrupt_flags);
+        uart_recv_loop(uart, &interrupt_flags, 1);
         if(interrupt_flags != 0)
         {
             uart_status = uart_read_status(uart);
@@ -0,0 +1,385 @@
+#if defined(__linux__)
+#define _GNU_SOURCE // REG_ERR
+#endif
+
+#include "watch.h"
+
+#include <stdio.h>
+
+volatile sig_atomic_t watch_pending = 0;
+
+#ifdef __MINGW32__
+
+cpu_t* watch_init(cpu_t *cpu)
+{
+    return cpu;
+}
+
+int watch_add(cpu_t *cpu, uint32_t start, uint32_t end, int access)
+{
+    puts("watchpoints need mprotect, not available on this host");
+    return -1;
+}
+
+int watch_step_done(cpu_t *cpu, uint32_t pc)
+{
+    return 0;
+}
+
+void watch_suspend()
+{
+}
+
+void watch_resume()
+{
+}
+
+void watch_host_access(uint32_t start, uint32_t len, int write)
+{
+}
+
+cpu_t* watch_clear(cpu_t *cpu)
+{
+    return cpu;
+}
+
+#else
+
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+typedef struct
+{
+    uint32_t start, end;
+    int access;
+} watch_t;
+
+typedef struct
+{
+    int watch;
+    uint32_t addr;
+    uint32_t old_value;
+    int write; // -1 if the host cannot tell
+} watch_hit_t;
+
+static watch_t watches[WATCH_MAX];
+static int watch_count = 0;
+
+static watch_hit_t hits[WATCH_MAX];
+static volatile int hit_count = 0;
+
+static uint8_t *ram_base, *flash_base;
+static uint32_t ram_size, flash_size;
+static uintptr_t page_size;
+
+// the cpu from cpu_create while fsim runs a copy in mapping
+static cpu_t *original_cpu = NULL;
+static uint8_t *mapping;
+static size_t mapping_size;
+
+static int suspended = 0;
+
+static uint8_t* guest_to_host(uint32_t addr)
+{
+    if(addr < ram_size)
+    {
+        return ram_base + addr;
+    }
+    return flash_base + (addr - ram_size);
+}
+
+static int host_to_guest(const uint8_t *p, uint32_t *addr)
+{
+    if(p >= ram_base && p < ram_base + ram_size)
+    {
+        *addr = p - ram_base;
+        return 1;
+    }
+    if(p >= flash_base && p < flash_base + flash_size)
+    {
+        *addr = ram_size + (p - flash_base);
+        return 1;
+    }
+    return 0;
+}
+
+static uintptr_t first_page(const watch_t *w)
+{
+    return (uintptr_t)guest_to_host(w->start) & ~(page_size - 1);
+}
+
+static uintptr_t end_page(const watch_t *w)
+{
+    return ((uintptr_t)guest_to_host(w->end - 1) | (page_size - 1)) + 1;
+}
+
+static void protect_all()
+{
+    int i;
+
+    if(suspended)
+    {
+        return;
+    }
+
+    // pages shared by both kinds end up without any access
+    for(i = 0; i < watch_count; i++)
+    {
+        if(!watches[i].access)
+        {
+            mprotect((void*)first_page(&watches[i]), end_page(&watches[i]) - first_page(&watches[i]), PROT_READ);
+        }
+    }
+    for(i = 0; i < watch_count; i++)
+    {
+        if(watches[i].access)
+        {
+            mprotect((void*)first_page(&watches[i]), end_page(&watches[i]) - first_page(&watches[i]), PROT_NONE);
+        }
+    }
+}
+
+static void unprotect_all()
+{
+    int i;
+
+    for(i = 0; i < watch_count; i++)
+    {
+        mprotect((void*)first_page(&watches[i]), end_page(&watches[i]) - first_page(&watches[i]), PROT_READ | PROT_WRITE);
+    }
+}
+
+// up to 4 bytes at p, without touching the next (maybe protected) page
+static uint32_t read_value(const uint8_t *p)
+{
+    uintptr_t page = (uintptr_t)p & ~(page_size - 1);
+    uint32_t value = 0;
+    int k;
+
+    for(k = 0; k < 4 && (uintptr_t)(p + k) < page + page_size; k++)
+    {
+        value |= (uint32_t)p[k] << (k * 8);
+    }
+    return value;
+}
+
+// one hit per watchpoint and step, the first byte touched
+static void add_hit(int watch, uint32_t addr, int write)
+{
+    int j;
+
+    for(j = 0; j < hit_count && hits[j].watch != watch; j++);
+    if(j == hit_count && hit_count < WATCH_MAX)
+    {
+        hits[hit_count].watch = watch;
+        hits[hit_count].addr = addr;
+        hits[hit_count].old_value = read_value(guest_to_host(addr));
+        hits[hit_count].write = watches[watch].access ? write : 1;
+        hit_count++;
+    }
+    watch_pending = 1;
+}
+
+#if defined(__linux__) && defined(__x86_64__)
+#define TRAP_FLAG 0x100
+
+static void trap_handler(int sig, siginfo_t *info, void *context)
+{
+    ((ucontext_t*)context)->uc_mcontext.gregs[REG_EFL] &= ~TRAP_FLAG;
+    protect_all();
+}
+#endif
+
+static void fault_handler(int sig, siginfo_t *info, void *context)
+{
+    uint8_t *p = info->si_addr;
+    uintptr_t page = (uintptr_t)p & ~(page_size - 1);
+    uint32_t addr;
+    int i, write = -1, watched_page = 0;
+
+    for(i = 0; i < watch_count; i++)
+    {
+        if(page >= first_page(&watches[i]) && page < end_page(&watches[i]))
+        {
+            watched_page = 1;
+        }
+    }
+    if(!watched_page)
+    {
+        // a real crash, fault again without this handler
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    // let the access through. On x86-64 the trap flag single steps the
+    // faulting host instruction and the page is protected again right
+    // after it, so later accesses of the same step still trap. Elsewhere
+    // the page stays open until the end of the step.
+    mprotect((void*)page, page_size, PROT_READ | PROT_WRITE);
+    watch_pending = 1;
+
+#if defined(__linux__) && defined(__x86_64__)
+    write = (((ucontext_t*)context)->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+    ((ucontext_t*)context)->uc_mcontext.gregs[REG_EFL] |= TRAP_FLAG;
+#endif
+
+    if(!host_to_guest(p, &addr))
+    {
+        return;
+    }
+    for(i = 0; i < watch_count; i++)
+    {
+        if(addr >= watches[i].start && addr < watches[i].end && (watches[i].access || write != 0))
+        {
+            add_hit(i, addr, write);
+            break;
+        }
+    }
+}
+
+// core 0 is the machine of itself, the copy has to point to its own memory
+static void move_machine(cpu_t *cpu)
+{
+    cpu->machine = cpu;
+    cpu->cores[0] = cpu;
+}
+
+cpu_t* watch_init(cpu_t *cpu)
+{
+    struct sigaction sa;
+    size_t offset;
+
+    page_size = sysconf(_SC_PAGESIZE);
+
+    // cpu_t embeds ram and flash behind the registers, the copy is placed
+    // so that ram starts on a page. The cpu keeps the alignment of the
+    // ram offset, at least 4 bytes, which x86 and ARM hosts access fine.
+    mapping_size = sizeof(cpu_t) + page_size;
+    mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mapping != MAP_FAILED)
+    {
+        offset = (page_size - offsetof(cpu_t, ram) % page_size) % page_size;
+        original_cpu = cpu;
+        cpu = (cpu_t*)(mapping + offset);
+        memcpy(cpu, original_cpu, sizeof(*cpu));
+        move_machine(cpu);
+    }
+    else
+    {
+        puts("could not map the cpu, watchpoints on the first ram page also catch register accesses");
+    }
+
+    ram_base = cpu->ram;
+    ram_size = sizeof(cpu->ram);
+    flash_base = cpu->flash;
+    flash_size = sizeof(cpu->flash);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = fault_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+#if defined(__linux__) && defined(__x86_64__)
+    sa.sa_sigaction = trap_handler;
+    sigaction(SIGTRAP, &sa, NULL);
+#endif
+    return cpu;
+}
+
+int watch_add(cpu_t *cpu, uint32_t start, uint32_t end, int access)
+{
+    if(start >= end || end > sizeof(cpu->ram) + sizeof(cpu->flash) ||
+       (start < sizeof(cpu->ram) && end > sizeof(cpu->ram)))
+    {
+        printf("watchpoint %08x-%08x is not inside ram or flash\n", start, end);
+        return -1;
+    }
+    if(watch_count == WATCH_MAX)
+    {
+        printf("at most %d watchpoints\n", WATCH_MAX);
+        return -1;
+    }
+
+    watches[watch_count].start = start;
+    watches[watch_count].end = end;
+    watches[watch_count].access = access;
+    watch_count++;
+
+    protect_all();
+    return 0;
+}
+
+int watch_step_done(cpu_t *cpu, uint32_t pc)
+{
+    static const char *kind[] = { "access", "read", "write" };
+    int i, n = hit_count;
+    uint32_t addr;
+
+    // reading the new value is no hit
+    watch_suspend();
+    for(i = 0; i < n; i++)
+    {
+        addr = hits[i].addr;
+        printf("Watchpoint: %s at %08x by instruction at %08x, %08x -> %08x\n",
+               kind[hits[i].write + 1], addr, pc, hits[i].old_value, cpu_read(addr, cpu));
+    }
+
+    hit_count = 0;
+    watch_pending = 0;
+    watch_resume();
+    return n;
+}
+
+void watch_suspend()
+{
+    if(suspended++ == 0)
+    {
+        unprotect_all();
+    }
+}
+
+void watch_resume()
+{
+    if(suspended > 0 && --suspended == 0)
+    {
+        protect_all();
+    }
+}
+
+void watch_host_access(uint32_t start, uint32_t len, int write)
+{
+    int i;
+
+    for(i = 0; i < watch_count; i++)
+    {
+        if(start < watches[i].end && start + len > watches[i].start && (watches[i].access || write))
+        {
+            add_hit(i, start > watches[i].start ? start : watches[i].start, write);
+        }
+    }
+}
+
+cpu_t* watch_clear(cpu_t *cpu)
+{
+    unprotect_all();
+    watch_count = 0;
+    hit_count = 0;
+    watch_pending = 0;
+    suspended = 0;
+
+    if(original_cpu)
+    {
+        memcpy(original_cpu, cpu, sizeof(*cpu));
+        cpu = original_cpu;
+        move_machine(cpu);
+        original_cpu = NULL;
+        munmap(mapping, mapping_size);
+    }
+    return cpu;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "cpu.h"
+
+#include <signal.h>
+#include <stdint.h>
+
+#define WATCH_MAX 16
+
+// set by the fault handler, checked by fsim after every step
+extern volatile sig_atomic_t watch_pending;
+
+// Moves the cpu to a mapping where ram and flash start on a page, so no
+// watched page holds registers or other host data, and installs the
+// fault handler. Call it before watch_add and use the returned cpu.
+cpu_t* watch_init(cpu_t *cpu);
+
+// Watches guest addresses start up to end (exclusive) in ram or flash.
+// Writes are always caught, reads only if access is set. The host pages
+// behind the range are protected, so unwatched accesses cost nothing.
+// Returns 0 on success.
+int watch_add(cpu_t *cpu, uint32_t start, uint32_t end, int access);
+
+// Reports the hits of the last step executed from pc and protects the
+// pages again. Returns the number of hits.
+int watch_step_done(cpu_t *cpu, uint32_t pc);
+
+// Host code that reads or writes guest memory (semihosting, snapshots,
+// dumps) runs between watch_suspend and watch_resume, the pages are open
+// and its accesses are no hits. Calls nest.
+void watch_suspend();
+void watch_resume();
+
+// Reports a host access to len bytes at start as a hit of the running
+// instruction, e.g. a semihosting read into a watched buffer. Call it
+// while suspended and before a write, the old value is read here.
+void watch_host_access(uint32_t start, uint32_t len, int write);
+
+// Removes all watchpoints and moves the cpu back to the allocation of
+// cpu_create, returns it for cpu_free.
+cpu_t* watch_clear(cpu_t *cpu);
+
+#endif
@@ -0,0 +1,151 @@
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+
+-- Direct mapped instruction cache between the fetch stage and the ram
+-- controller. Instruction bytes live in block ram (one cycle read), tags
+-- and valid bits in distributed ram. A miss refills the whole line byte by
+-- byte from the memory side; stores from the execute stage invalidate a
+-- matching line so self modifying code stays coherent, including a store
+-- into the line that is being refilled.
+--
+-- lines and line_bytes must be powers of two.
+entity icache is
+	generic ( lines : positive := 64;
+	          line_bytes : positive := 8 );
+	port ( clk : in std_logic;
+	       -- fetch side, ready answers the current rd request
+	       addr : in std_logic_vector (23 downto 0);
+	       rd : in std_logic;
+	       wr : in std_logic;
+	       ack : in std_logic;
+	       rd_data : out std_logic_vector (7 downto 0);
+	       ready : out std_logic;
+	       -- memory side, owned by the cache while busy
+	       busy : out std_logic;
+	       mem_addr : out std_logic_vector (23 downto 0);
+	       mem_rd : out std_logic;
+	       mem_data : in std_logic_vector (7 downto 0);
+	       mem_ready : in std_logic;
+	       -- statistics
+	       hits : out unsigned (31 downto 0);
+	       misses : out unsigned (31 downto 0) );
+end icache;
+
+architecture behavioral of icache is
+	constant cache_bytes : positive := lines * line_bytes;
+
+	subtype byte_type is std_logic_vector (7 downto 0);
+	type data_type is array (0 to cache_bytes-1) of byte_type;
+	type tag_type is array (0 to lines-1) of natural range 0 to 2**24 / cache_bytes - 1;
+
+	function line_of (a : std_logic_vector) return natural is
+	begin
+		return (to_integer(unsigned(a)) / line_bytes) mod lines;
+	end function;
+
+	function tag_of (a : std_logic_vector) return natural is
+	begin
+		return to_integer(unsigned(a)) / cache_bytes;
+	end function;
+
+	function index_of (a : std_logic_vector) return natural is
+	begin
+		return to_integer(unsigned(a)) mod cache_bytes;
+	end function;
+
+	signal data : data_type;
+	signal data_q : byte_type;
+	signal data_we : std_logic;
+	signal data_waddr : std_logic_vector (23 downto 0);
+
+	signal tags : tag_type := (others => 0);
+	signal valid : std_logic_vector (0 to lines-1) := (others => '0');
+
+	signal look_addr : std_logic_vector (23 downto 0) := (others => '1');
+	signal look_ok : std_logic := '0';
+	signal hit : std_logic;
+
+	type state_type is (idle, refill);
+	signal state : state_type := idle;
+	signal refill_base : unsigned (23 downto 0);
+	signal refill_count : integer range 0 to line_bytes-1;
+	signal refill_stale : std_logic;
+	signal refill_store : std_logic;
+
+	signal hit_count : unsigned (31 downto 0) := (others => '0');
+	signal miss_count : unsigned (31 downto 0) := (others => '0');
+begin
+	hits <= hit_count;
+	misses <= miss_count;
+
+	hit <= '1' when valid (line_of(addr)) = '1' and tags (line_of(addr)) = tag_of(addr) else '0';
+
+	-- block ram holds the data read for look_addr one cycle later
+	ready <= '1' when rd = '1' and state = idle and hit = '1' and look_ok = '1' and look_addr = addr else '0';
+	rd_data <= data_q;
+
+	-- a store into the line being refilled, its old byte may be fetched already
+	refill_store <= '1' when state = refill and ack = '1' and wr = '1' and
+	                unsigned(addr) - refill_base < line_bytes else '0';
+
+	busy <= '1' when state = refill else '0';
+	mem_rd <= '1' when state = refill else '0';
+	data_waddr <= std_logic_vector(refill_base + refill_count);
+	mem_addr <= data_waddr;
+	data_we <= '1' when state = refill and mem_ready = '1' else '0';
+
+	data_port : process(clk)
+	begin
+		if rising_edge(clk) then
+			if data_we = '1' then
+				data (index_of(data_waddr)) <= mem_data;
+			end if;
+			data_q <= data (index_of(addr));
+		end if;
+	end process;
+
+	control : process(clk)
+	begin
+		if rising_edge(clk) then
+			look_addr <= addr;
+			look_ok <= not data_we;
+
+			if ack = '1' and rd = '1' and hit = '1' then
+				hit_count <= hit_count + 1;
+			end if;
+
+			if ack = '1' and wr = '1' and hit = '1' then
+				valid (line_of(addr)) <= '0';
+			end if;
+
+			case state is
+				when idle =>
+					if rd = '1' and hit = '0' then
+						refill_base <= unsigned(addr) - index_of(addr) mod line_bytes;
+						refill_count <= 0;
+						refill_stale <= '0';
+						valid (line_of(addr)) <= '0';
+						tags (line_of(addr)) <= tag_of(addr);
+						miss_count <= miss_count + 1;
+						state <= refill;
+					end if;
+
+				when refill =>
+					if refill_store = '1' then
+						refill_stale <= '1';
+					end if;
+					if mem_ready = '1' then
+						if refill_count = line_bytes-1 then
+							-- a stale line stays invalid and is refilled on the next fetch
+							valid (to_integer(refill_base) / line_bytes mod lines) <= not (refill_stale or refill_store);
+							state <= idle;
+						else
+							refill_count <= refill_count + 1;
+						end if;
+					end if;
+			end case;
+		end if;
+	end process;
+
+end behavioral;
@@ -0,0 +1,246 @@
+library ieee;
+use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
+
+-- Micron Cellular RAM in synchronous burst mode.
+--
+-- After power up the bus configuration register is written asynchronously
+-- (synchronous mode, variable latency, wait active high, no wrap). Reads
+-- then fill a line buffer with one burst of burst_words words starting at
+-- the requested word, so the remaining bytes of an instruction are served
+-- from the buffer. Writes are single word bursts with byte lane select.
+--
+-- ram_clk runs at clk/2. Outputs change and inputs are sampled on its
+-- falling edge, half a ram clock after the ram drives wait and data.
+entity ram_controller is
+	generic ( burst_words : positive := 4;
+	          power_up_cycles : positive := 3750 ); -- 150 us at 25 MHz ram_clk
+	port ( clk : in std_logic;
+	       -- byte port, ready answers the current rd/wr request
+	       addr : in std_logic_vector (23 downto 0);
+	       rd : in std_logic;
+	       wr : in std_logic;
+	       ack : in std_logic;
+	       wr_data : in std_logic_vector (7 downto 0);
+	       rd_data : out std_logic_vector (7 downto 0);
+	       ready : out std_logic;
+	       -- cellular ram
+	       ram_clk : out std_logic;
+	       ram_adv : out std_logic;
+	       ram_ce : out std_logic;
+	       ram_cre : out std_logic;
+	       ram_lb : out std_logic;
+	       ram_ub : out std_logic;
+	       ram_wait : in std_logic;
+	       mem_oe : out std_logic;
+	       mem_we : out std_logic;
+	       mem_addr : out std_logic_vector (23 downto 1);
+	       mem_data : inout std_logic_vector (15 downto 0) );
+end ram_controller;
+
+architecture behavioral of ram_controller is
+	subtype ram_word_type is std_logic_vector (15 downto 0);
+	type line_type is array (0 to burst_words-1) of ram_word_type;
+
+	function bcr_value return std_logic_vector is
+		variable bcr : std_logic_vector (22 downto 0) := (others => '0');
+	begin
+		bcr(19 downto 18) := "10";   -- select bus configuration register
+		bcr(15) := '0';              -- synchronous burst mode
+		bcr(14) := '0';              -- variable latency
+		bcr(13 downto 11) := "011";  -- latency code 3
+		bcr(10) := '1';              -- wait active high
+		bcr(8) := '0';               -- wait asserted during delay
+		bcr(5 downto 4) := "01";     -- 1/2 drive strength
+		bcr(3) := '1';               -- no burst wrap
+		case burst_words is
+			when 4 => bcr(2 downto 0) := "001";
+			when 8 => bcr(2 downto 0) := "010";
+			when 16 => bcr(2 downto 0) := "011";
+			when 32 => bcr(2 downto 0) := "100";
+			when others =>
+				report "burst_words must be 4, 8, 16 or 32" severity failure;
+		end case;
+		return bcr;
+	end function;
+
+	constant bcr_config : std_logic_vector (22 downto 0) := bcr_value;
+
+	type state_type is
+		( power_up,
+		  cfg_write,
+		  cfg_release,
+		  idle,
+		  rd_addr,
+		  rd_data_phase,
+		  wr_addr,
+		  wr_data_phase );
+
+	signal state : state_type := power_up;
+	signal count : integer range 0 to power_up_cycles := power_up_cycles;
+
+	signal phase : std_logic := '0';
+	signal clk_run : std_logic := '0';
+
+	signal adv : std_logic := '1';
+	signal ce : std_logic := '1';
+	signal cre : std_logic := '0';
+	signal oe : std_logic := '1';
+	signal we : std_logic := '1';
+	signal lb : std_logic := '1';
+	signal ub : std_logic := '1';
+	signal addr_out : std_logic_vector (23 downto 1) := (others => '0');
+	signal data_out : ram_word_type;
+	signal data_wr : std_logic := '0';
+
+	signal line : line_type;
+	signal line_base : unsigned (23 downto 1) := (others => '0');
+	signal line_valid : std_logic := '0';
+	signal line_offset : unsigned (23 downto 1);
+	signal line_word : ram_word_type;
+	signal hit : std_logic;
+
+	signal wr_done : std_logic := '0';
+begin
+	ram_clk <= phase when clk_run = '1' else '0';
+	ram_adv <= adv;
+	ram_ce <= ce;
+	ram_cre <= cre;
+	ram_lb <= lb;
+	ram_ub <= ub;
+	mem_oe <= oe;
+	mem_we <= we;
+	mem_addr <= addr_out;
+	mem_data <= data_out when data_wr = '1' else (others => 'Z');
+
+	line_offset <= unsigned(addr (23 downto 1)) - line_base;
+	hit <= '1' when line_valid = '1' and line_offset < burst_words else '0';
+
+	line_read : process(hit, line, line_offset)
+	begin
+		if hit = '1' then
+			line_word <= line (to_integer(line_offset));
+		else
+			line_word <= (others => '0');
+		end if;
+	end process;
+
+	rd_data <= line_word (15 downto 8) when addr (0) = '1' else line_word (7 downto 0);
+	ready <= (rd and hit) or (wr and wr_done);
+
+	control : process(clk)
+	begin
+		if rising_edge(clk) then
+			phase <= not phase;
+
+			if ack = '1' then
+				wr_done <= '0';
+			end if;
+
+			if phase = '1' then
+				case state is
+					when power_up =>
+						if count = 0 then
+							-- asynchronous configuration register write
+							addr_out <= bcr_config;
+							cre <= '1';
+							ce <= '0';
+							adv <= '0';
+							we <= '0';
+							count <= 2;
+							state <= cfg_write;
+						else
+							count <= count - 1;
+						end if;
+
+					when cfg_write =>
+						-- register is latched on the rising edge of ce#/we#/adv#
+						if count = 0 then
+							ce <= '1';
+							adv <= '1';
+							we <= '1';
+							state <= cfg_release;
+						else
+							count <= count - 1;
+						end if;
+
+					when cfg_release =>
+						cre <= '0';
+						clk_run <= '1';
+						state <= idle;
+
+					when idle =>
+						if wr = '1' and wr_done = '0' then
+							addr_out <= addr (23 downto 1);
+							ce <= '0';
+							adv <= '0';
+							we <= '0';
+							lb <= addr (0);
+							ub <= not addr (0);
+							data_out <= wr_data & wr_data;
+							data_wr <= '1';
+							state <= wr_addr;
+						elsif rd = '1' and hit = '0' then
+							addr_out <= addr (23 downto 1);
+							ce <= '0';
+							adv <= '0';
+							lb <= '0';
+							ub <= '0';
+							line_base <= unsigned(addr (23 downto 1));
+							line_valid <= '0';
+							count <= 0;
+							state <= rd_addr;
+						end if;
+
+					when rd_addr =>
+						adv <= '1';
+						oe <= '0';
+						state <= rd_data_phase;
+
+					when rd_data_phase =>
+						if ram_wait = '0' then
+							line (count) <= mem_data;
+							if count = burst_words-1 then
+								-- ce# high ends the burst
+								ce <= '1';
+								oe <= '1';
+								lb <= '1';
+								ub <= '1';
+								line_valid <= '1';
+								state <= idle;
+							else
+								count <= count + 1;
+							end if;
+						end if;
+
+					when wr_addr =>
+						adv <= '1';
+						we <= '1';
+						state <= wr_data_phase;
+
+					when wr_data_phase =>
+						-- the word was taken on the edge wait went low,
+						-- end the burst before the next one
+						if ram_wait = '0' then
+							ce <= '1';
+							lb <= '1';
+							ub <= '1';
+							data_wr <= '0';
+							wr_done <= '1';
+
+							if hit = '1' then
+								if addr (0) = '1' then
+									line (to_integer(line_offset)) (15 downto 8) <= data_out (7 downto 0);
+								else
+									line (to_integer(line_offset)) (7 downto 0) <= data_out (7 downto 0);
+								end if;
+							end if;
+
+							state <= idle;
+						end if;
+				end case;
+			end if;
+		end if;
+	end process;
+
+end behavioral;
@@ -5,6 +5,7 @@ use work.sseg.all;
 
 
 entity toplevel is
+	generic ( cpu_divider : positive := 50000000 ); -- one pipeline cycle per cpu clock enable
 	port ( clk : in std_logic;
 		    sseg : out  std_logic_vector (7 downto 0);
 		    anodes : out  std_logic_vector (3 downto 0);
@@ -23,7 +24,9 @@ entity toplevel is
 			 flash_ce : out std_logic;
 			 --flash_st_sts : in std_logic;
 			 mem_addr : out std_logic_vector (23 downto 1);
-			 mem_data : inout std_logic_vector (15 downto 0) );
+			 mem_data : inout std_logic_vector (15 downto 0);
+			 rs_rx : in std_logic;
+			 rs_tx : out std_logic );
 end toplevel;
 
 architecture behavioral of toplevel is
@@ -39,34 +42,72 @@ architecture behavioral of toplevel is
 	signal addr_bus : word_type;
 	signal data_bus : word_type;
 	
-	signal pc : word_type;
-	signal reg_a : word_type;
+	signal pc : word_type := (others => '0');
+	signal reg_a : word_type := (others => '0');
 	
 	signal memory_data_bus : word_type;
 	
-	type ucode_state_type is
-		( inc_pc,
-		  load_instr,
-		  fetch_instr, 
-		  nop,
-		  lda_imm_1,
-		  lda_imm_2,
-		  lda_imm_3,
-		  lda_abs_1,
-		  lda_abs_2,
-		  lda_abs_3,
-		  lda_abs_4,
-		  sta_abs_1,
-		  sta_abs_2,
-		  sta_abs_3,
-		  halt,
+	type memory_type is array ( natural range <> ) of word_type;
+	
+	-- fetch stage: bytes are streamed into a small prefetch queue,
+	-- one memory read per cycle while the execute stage leaves the port free
+	type fetch_queue_type is array (0 to 3) of word_type;
+	
+	signal fetch_queue : fetch_queue_type;
+	signal fetch_count : integer range 0 to 4 := 0;
+	signal fetch_pc : word_type := (others => '0');
+	signal fetch_pending : std_logic := '0';
+	signal fetch_issue : std_logic;
+	
+	-- execute stage: runs the instruction decoded from the head of the queue
+	type ex_state_type is
+		( ex_idle,
+		  ex_run,
+		  ex_lda_abs_wb,
 		  panic );
-
-	signal ucode_state : ucode_state_type := load_instr;
 	
-	signal mem_data_in : std_logic_vector (15 downto 0);
-	signal mem_data_out : std_logic_vector (15 downto 0);
-	signal mem_data_wr : std_logic;
+	signal ex_state : ex_state_type := ex_idle;
+	signal ex_opcode : word_type;
+	signal ex_operand : word_type;
+	signal ex_next_pc : word_type := (others => '0');
+	
+	-- memory port, the execute stage has priority over fetch
+	signal port_ex : std_logic;
+	signal port_wr : std_logic;
+	signal port_rd : std_logic;
+	signal port_addr : word_type;
+	signal port_external : std_logic;
+	signal port_periph : std_logic;
+	signal port_uart : std_logic;
+	
+	-- one pipeline step per cpu clock enable, held while the ram is busy
+	signal cpu_tick : std_logic := '0';
+	signal cpu_step : std_logic;
+	
+	signal ram_rd : std_logic;
+	signal ram_wr : std_logic;
+	signal ram_ready : std_logic;
+	signal ram_data : word_type;
+	signal ram_port_addr : std_logic_vector (23 downto 0);
+	signal ram_addr : std_logic_vector (23 downto 0);
+	
+	-- instruction fetches from ram go through the cache
+	signal cache_rd : std_logic;
+	signal cache_wr : std_logic;
+	signal cache_ready : std_logic;
+	signal cache_data : word_type;
+	signal cache_busy : std_logic;
+	signal cache_mem_addr : std_logic_vector (23 downto 0);
+	signal cache_mem_rd : std_logic;
+	signal cache_hits : unsigned (31 downto 0);
+	signal cache_misses : unsigned (31 downto 0);
+	
+	signal data_rd : std_logic;
+	signal periph_data : word_type;
+	
+	signal uart_rd : std_logic;
+	signal uart_wr : std_logic;
+	signal uart_data : word_type;
 	
 	signal clock_toggel_enable : std_logic;
 	signal clock_toggel : std_logic := '1';
@@ -76,6 +117,19 @@ architecture behavioral of toplevel is
 	constant opcode_sta_abs : word_type := "00000011";
 	constant opcode_nop : word_type := "00001111";
 	
+	-- stores and reads back #$af at $e0, then writes "nop nop lda $f4 sta $e1"
+	-- to $20 and runs it from ram, which stores the cache miss count to $e1
+	constant rom : memory_type (0 to 31) :=
+		( opcode_nop,
+		  opcode_lda_imm, "10101111", opcode_sta_abs, "11100000",
+		  opcode_lda_imm, "00000000", opcode_lda_abs, "11100000",
+		  opcode_lda_imm, opcode_nop, opcode_sta_abs, "00100000", opcode_sta_abs, "00100001",
+		  opcode_lda_imm, opcode_lda_abs, opcode_sta_abs, "00100010",
+		  opcode_lda_imm, "11110100", opcode_sta_abs, "00100011",
+		  opcode_lda_imm, opcode_sta_abs, opcode_sta_abs, "00100100",
+		  opcode_lda_imm, "11100001", opcode_sta_abs, "00100101",
+		  others => opcode_nop );
+	
 begin
 	sseg_clock : entity work.clock_enable_generator(behavioral)
 		generic map ( divider => freq/500 )
@@ -86,7 +140,7 @@ begin
 		port map (clk => clk, clk_enable => clock_toggel_enable); 
 
 	cpu_clock : entity work.clock_enable_generator(behavioral)
-		generic map ( divider => freq )
+		generic map ( divider => cpu_divider )
 		port map (clk => clk, clk_enable => cpu_clk_enable); 
 
 	sseg_controller : entity work.sseg_controller(behavioral)
@@ -96,22 +150,54 @@ begin
 					  sseg => sseg,
 					  anodes => anodes ); 
 					  
-	mem_data_in <= mem_data;
-	mem_data <= mem_data_out when mem_data_wr = '1' else (others => 'Z');
-	
-	-- RAM enabled
-	ram_ce <= '0';
-	
-	-- control registers disabled
-	ram_cre <= '0';
+	cache : entity work.icache(behavioral)
+		port map ( clk => clk,
+		           addr => ram_port_addr,
+		           rd => cache_rd,
+		           wr => cache_wr,
+		           ack => cpu_step,
+		           rd_data => cache_data,
+		           ready => cache_ready,
+		           busy => cache_busy,
+		           mem_addr => cache_mem_addr,
+		           mem_rd => cache_mem_rd,
+		           mem_data => ram_data,
+		           mem_ready => ram_ready,
+		           hits => cache_hits,
+		           misses => cache_misses );
 	
-	-- only lower byte enabled
-	ram_lb <= '0';
-	ram_ub <= '1';
+	ram : entity work.ram_controller(behavioral)
+		port map ( clk => clk,
+		           addr => ram_addr,
+		           rd => ram_rd,
+		           wr => ram_wr,
+		           ack => cpu_step,
+		           wr_data => reg_a,
+		           rd_data => ram_data,
+		           ready => ram_ready,
+		           ram_clk => ram_clk,
+		           ram_adv => ram_adv,
+		           ram_ce => ram_ce,
+		           ram_cre => ram_cre,
+		           ram_lb => ram_lb,
+		           ram_ub => ram_ub,
+		           ram_wait => ram_wait,
+		           mem_oe => mem_oe,
+		           mem_we => mem_we,
+		           mem_addr => mem_addr,
+		           mem_data => mem_data );
 	
-	-- clock/adv high due to async mode
-	ram_clk <= '1';
-	ram_adv <= '1';
+	-- the toy cpu has no interrupts, the irq line stays open
+	uart : entity work.uart(behavioral)
+		port map ( clk => clk,
+		           addr => port_addr (3 downto 0),
+		           rd => uart_rd,
+		           wr => uart_wr,
+		           wr_data => reg_a,
+		           rd_data => uart_data,
+		           irq => open,
+		           rx => rs_rx,
+		           tx => rs_tx );
 	
 	-- flash disabled
 	flash_ce <= '1';
@@ -119,14 +205,8 @@ begin
 	
 	leds(0) <= clock_toggel;
 	
-	with ucode_state select
-		leds(7 downto 1) <= "1000000" when inc_pc,
-		                    "0100000" when load_instr,
-							     "0010000" when fetch_instr,
-							     "0001000" when nop,
-							     "0000100" when halt,
-								  "1111111" when panic,
-							     "0000000" when others;
+	leds(7 downto 1) <= "1111111" when ex_state = panic else
+	                    fetch_issue & fetch_pending & port_ex & "0000";
 	
 	with switches (0) select
 		sseg_values <= ( addr_bus (7 downto 4), addr_bus (3 downto 0), data_bus (7 downto 4), data_bus (3 downto 0) ) when '1',
@@ -143,33 +223,62 @@ begin
 		end if;
 	end process;
 	
-	with ucode_state select
-		addr_bus <= pc when load_instr | lda_imm_2 | sta_abs_2 | lda_abs_2,
-						reg_a when sta_abs_3,
-                  (others => '0') when others;
+	port_ex <= '1' when ex_state = ex_run and (ex_opcode = opcode_lda_abs or ex_opcode = opcode_sta_abs) else '0';
+	port_wr <= '1' when ex_state = ex_run and ex_opcode = opcode_sta_abs else '0';
 	
-	with ucode_state select
-		data_bus <= memory_data_bus when fetch_instr | lda_imm_3 | sta_abs_3 | lda_abs_3 | lda_abs_4,
-                  (others => '0') when others;
+	-- structural hazard: fetch stalls while execute uses the port,
+	-- the byte still in flight counts against the queue
+	fetch_issue <= '1' when port_ex = '0' and ex_state /= panic and
+	                        ((fetch_pending = '0' and fetch_count < 4) or fetch_count < 3) else '0';
 	
-	pc_proc : process(clk)
-	begin
-		if rising_edge(clk) then
-			if cpu_clk_enable = '1' then
-				if ucode_state = inc_pc or ucode_state = lda_imm_1 or ucode_state = sta_abs_1 or ucode_state = lda_abs_1 then
-					pc <= std_logic_vector(unsigned(pc) + 1);
-				end if;
-			end if;
-		end if;
-	end process;
+	port_rd <= fetch_issue or (port_ex and not port_wr);
+	port_addr <= ex_operand when port_ex = '1' else fetch_pc;
+	
+	-- $f0-$f7: cache hit/miss counters, little endian
+	port_periph <= '1' when port_addr (7 downto 3) = "11110" else '0';
+	-- $d0-$df: uart, the offsets of $FF00 0000-$FF00 000F
+	port_uart <= '1' when port_addr (7 downto 4) = "1101" else '0';
+	port_external <= '1' when unsigned(port_addr) > rom'high and port_periph = '0' and port_uart = '0' else '0';
+	
+	-- only the execute stage reads the uart, a fetch must not pop the rx fifo
+	uart_rd <= cpu_step and port_ex and not port_wr and port_uart;
+	uart_wr <= cpu_step and port_wr and port_uart;
 	
-	reg_a_proc : process(clk)
+	with port_addr (2 downto 0) select
+		periph_data <= std_logic_vector(cache_hits (7 downto 0)) when "000",
+		               std_logic_vector(cache_hits (15 downto 8)) when "001",
+		               std_logic_vector(cache_hits (23 downto 16)) when "010",
+		               std_logic_vector(cache_hits (31 downto 24)) when "011",
+		               std_logic_vector(cache_misses (7 downto 0)) when "100",
+		               std_logic_vector(cache_misses (15 downto 8)) when "101",
+		               std_logic_vector(cache_misses (23 downto 16)) when "110",
+		               std_logic_vector(cache_misses (31 downto 24)) when others;
+	
+	addr_bus <= port_addr;
+	data_bus <= memory_data_bus;
+	
+	ram_port_addr <= "0000000000000000" & port_addr;
+	cache_rd <= fetch_issue and port_external;
+	cache_wr <= port_wr and port_external;
+	data_rd <= port_ex and not port_wr and port_external;
+	
+	-- a refill owns the ram while the fetch waits for it
+	ram_addr <= cache_mem_addr when cache_busy = '1' else ram_port_addr;
+	ram_rd <= cache_mem_rd when cache_busy = '1' else data_rd;
+	ram_wr <= port_wr and port_external and not cache_busy;
+	
+	-- a store waits for a refill to finish instead of being dropped
+	cpu_step <= (cpu_clk_enable or cpu_tick) and not
+	            ((cache_rd and not cache_ready) or ((data_rd or ram_wr) and not ram_ready) or
+	             (cache_wr and cache_busy));
+	
+	tick : process(clk)
 	begin
 		if rising_edge(clk) then
-			if cpu_clk_enable = '1' then
-				if ucode_state = lda_imm_3 or ucode_state = lda_abs_4 then
-					reg_a <= data_bus;
-				end if;
+			if cpu_step = '1' then
+				cpu_tick <= '0';
+			elsif cpu_clk_enable = '1' then
+				cpu_tick <= '1';
 			end if;
 		end if;
 	end process;
@@ -216,138 +325,121 @@ begin
 --	end process;
 
 	memory : process(clk)
-		type memory_type is array ( natural range <> ) of word_type;
-		constant rom : memory_type (0 to 11) := (opcode_nop, opcode_lda_imm, "10101111", opcode_sta_abs, "11100000", opcode_lda_imm, "00000000", opcode_lda_abs, "11100000", others => opcode_nop);
 	begin
 		if rising_edge(clk) then
-			if cpu_clk_enable = '1' then
-				case ucode_state is
-					when load_instr | lda_imm_2 | sta_abs_2 | lda_abs_2 =>
-						if unsigned(addr_bus) > 12 then
-							mem_addr <= "000000000000000" & addr_bus;
-							memory_data_bus <= mem_data_in (7 downto 0);
-							mem_oe <= '0';
-							mem_we <= '1';
-							mem_data_wr <= '0';
-						else
-							mem_addr <= (others => '0');
-							memory_data_bus <= rom (to_integer(unsigned(addr_bus)));
-							mem_oe <= '1';
-							mem_we <= '1';
-							mem_data_wr <= '0';
-						end if;
-					when lda_abs_3 =>
-						if unsigned(data_bus) > 12 then
-							mem_addr <= "000000000000000" & data_bus;
-							memory_data_bus <= mem_data_in (7 downto 0);
-							mem_oe <= '0';
-							mem_we <= '1';
-							mem_data_wr <= '0';
-						else
-							mem_addr <= (others => '0');
-							memory_data_bus <= rom (to_integer(unsigned(data_bus)));
-							mem_oe <= '1';
-							mem_we <= '1';
-							mem_data_wr <= '0';
-						end if;
-					when sta_abs_3 =>
-						memory_data_bus <= (others => '0');
-						if unsigned(data_bus) > 12 then
-							mem_addr <= "000000000000000" & data_bus;
-							mem_data_out <= "00000000" & addr_bus;
-							mem_oe <= '0';
-							mem_we <= '0';
-							mem_data_wr <= '1';
-						else
-							mem_addr <= (others => '0');
-							mem_oe <= '1';
-							mem_we <= '1';
-							mem_data_wr <= '0';
-						end if;
-					when others =>
-						mem_addr <= (others => '0');
-						memory_data_bus <= (others => '0');
-						mem_oe <= '1';
-						mem_we <= '1';
-						mem_data_wr <= '0';
-				end case;
+			if cpu_step = '1' then
+				if port_rd = '1' then
+					if port_periph = '1' then
+						memory_data_bus <= periph_data;
+					elsif port_uart = '1' then
+						memory_data_bus <= uart_data;
+					elsif port_external = '1' and port_ex = '0' then
+						memory_data_bus <= cache_data;
+					elsif port_external = '1' then
+						memory_data_bus <= ram_data;
+					else
+						memory_data_bus <= rom (to_integer(unsigned(port_addr)));
+					end if;
+				end if;
 			end if;
 		end if;
 	end process;
 	
-	ucode : process(clk)
+	pipeline : process(clk)
+		variable queue : fetch_queue_type;
+		variable count : integer range 0 to 4;
+		variable length : integer range 1 to 2;
+		variable ex_free : boolean;
+		variable known : boolean;
 	begin
 		if rising_edge(clk) then
-			if cpu_clk_enable = '1' then
-				case ucode_state is
-					when inc_pc =>
-						ucode_state <= load_instr;
-					
-					when load_instr =>
-						ucode_state <= fetch_instr;
-						
-					when fetch_instr =>
-						case data_bus is
-							when opcode_nop =>
-								ucode_state <= nop;
-								
+			if cpu_step = '1' then
+				queue := fetch_queue;
+				count := fetch_count;
+				
+				-- fetch: the byte read in the previous cycle arrives
+				if fetch_pending = '1' then
+					queue(count) := memory_data_bus;
+					count := count + 1;
+				end if;
+				
+				fetch_pending <= fetch_issue;
+				if fetch_issue = '1' then
+					fetch_pc <= std_logic_vector(unsigned(fetch_pc) + 1);
+				end if;
+				
+				-- execute
+				ex_free := true;
+				case ex_state is
+					when ex_run =>
+						case ex_opcode is
 							when opcode_lda_imm =>
-								ucode_state <= lda_imm_1;
+								reg_a <= ex_operand;
 								
 							when opcode_lda_abs =>
-								ucode_state <= lda_abs_1;
+								ex_free := false;
+								ex_state <= ex_lda_abs_wb;
 								
 							when opcode_sta_abs =>
-								ucode_state <= sta_abs_1;
-
+								-- store into already prefetched bytes: flush and refetch
+								if unsigned(ex_operand) - unsigned(ex_next_pc) < unsigned(fetch_pc) - unsigned(ex_next_pc) then
+									count := 0;
+									fetch_pending <= '0';
+									fetch_pc <= ex_next_pc;
+								end if;
+								
 							when others =>
-								ucode_state <= panic;
+								null;
 						end case;
 						
-					when lda_imm_1 =>
-						ucode_state <= lda_imm_2;
-					
-					when lda_imm_2 =>
-						ucode_state <= lda_imm_3;
-					
-					when lda_imm_3 =>
-						ucode_state <= inc_pc;
-						
-					
-					when lda_abs_1 =>
-						ucode_state <= lda_abs_2;
-					
-					when lda_abs_2 =>
-						ucode_state <= lda_abs_3;
+					when ex_lda_abs_wb =>
+						reg_a <= memory_data_bus;
 						
-					when lda_abs_3 =>
-						ucode_state <= lda_abs_4;
-						
-					when lda_abs_4 =>
-						ucode_state <= inc_pc;
-						
-					
-					when sta_abs_1 =>
-						ucode_state <= sta_abs_2;
-					
-					when sta_abs_2 =>
-						ucode_state <= sta_abs_3;
-					
-					when sta_abs_3 =>
-						ucode_state <= inc_pc;
-						
-					
-					when nop =>
-						ucode_state <= inc_pc;
+					when panic =>
+						ex_free := false;
 						
+					when ex_idle =>
+						null;
+				end case;
+				
+				-- decode: hand the next complete instruction to execute
+				if ex_free then
+					ex_state <= ex_idle;
 					
-					when halt =>
-						ucode_state <= halt;
-						
+					if count > 0 then
+						known := true;
+						case queue(0) is
+							when opcode_nop =>
+								length := 1;
+							when opcode_lda_imm | opcode_lda_abs | opcode_sta_abs =>
+								length := 2;
+							when others =>
+								known := false;
+								length := 1;
+						end case;
 						
-					when others =>
-						ucode_state <= panic;
-				end case;
+						if not known then
+							pc <= ex_next_pc;
+							ex_state <= panic;
+						elsif count >= length then
+							ex_state <= ex_run;
+							ex_opcode <= queue(0);
+							ex_operand <= queue(1);
+							pc <= ex_next_pc;
+							ex_next_pc <= std_logic_vector(unsigned(ex_next_pc) + length);
+							
+							if length = 1 then
+								queue(0 to 2) := queue(1 to 3);
+							else
+								queue(0 to 1) := queue(2 to 3);
+							end if;
+							count := count - length;
+						end if;
+					end if;
+				end if;
+				
+				fetch_queue <= queue;
+				fetch_count <= count;
 			end if;
 		end if;
 	end process;
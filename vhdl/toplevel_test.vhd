@@ -1,5 +1,6 @@
 library ieee;
 use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
  
 entity toplevel_test is
 end toplevel_test;
@@ -7,6 +8,7 @@ end toplevel_test;
 architecture behavior of toplevel_test is 
  
     component toplevel
+    generic ( cpu_divider : positive );
     port( clk : in std_logic;
 		    sseg : out  std_logic_vector (7 downto 0);
 		    anodes : out  std_logic_vector (3 downto 0);
@@ -25,7 +27,9 @@ architecture behavior of toplevel_test is
 			 flash_ce : out std_logic;
 			 --flash_st_sts : in std_logic;
 			 mem_addr : out std_logic_vector (23 downto 1);
-			 mem_data : inout std_logic_vector (15 downto 0)
+			 mem_data : inout std_logic_vector (15 downto 0);
+			 rs_rx : in std_logic;
+			 rs_tx : out std_logic
         );
     end component;
     
@@ -33,6 +37,7 @@ architecture behavior of toplevel_test is
    signal clk : std_logic := '0';
 	signal ram_wait : std_logic := '0'; 
 	signal switches : std_logic_vector (7 downto 0) := (others => '0'); 
+	signal rs_rx : std_logic := '1';
 
  	--outputs
    signal sseg : std_logic_vector(7 downto 0);
@@ -51,14 +56,21 @@ architecture behavior of toplevel_test is
 	signal mem_addr : std_logic_vector (23 downto 1);
 	
 	signal mem_data : std_logic_vector (15 downto 0);
+	signal rs_tx : std_logic;
 
    -- clock period definitions
    constant clk_period : time := 10 ps;
+   constant cpu_divider : positive := 2;
+   constant cpu_period : time := clk_period * cpu_divider;
+   -- covers the 150 us ram power up at the real clock divided by 2
+   constant timeout : time := clk_period * 20000;
  
 begin
  
 	-- instantiate the unit under test (uut)
-   uut: toplevel port map (
+   uut: toplevel
+		generic map ( cpu_divider => cpu_divider )
+		port map (
           clk => clk,
           sseg => sseg,
           anodes => anodes,
@@ -76,7 +88,9 @@ begin
 			 flash_rp => flash_rp,
 			 flash_ce => flash_ce,
 			 mem_addr => mem_addr,
-			 mem_data => mem_data
+			 mem_data => mem_data,
+			 rs_rx => rs_rx,
+			 rs_tx => rs_tx
         );
 
    -- clock process definitions
@@ -89,16 +103,92 @@ begin
    end process;
  
 
+   -- behavioral cellular ram: asynchronous configuration register write,
+   -- synchronous variable latency bursts, wait active high
+   ram_model : process (ram_clk, ram_ce, mem_we)
+      type ram_type is array (0 to 255) of std_logic_vector (15 downto 0);
+      variable ram : ram_type := (others => (others => '0'));
+      variable addr : integer := 0;
+      variable latency : integer := 0;
+      variable writing : boolean := false;
+      variable synchronous : boolean := false;
+   begin
+      if ram_cre = '1' and rising_edge(mem_we) then
+         assert mem_addr (20 downto 19) = "10" report "configuration write is not to the bcr" severity failure;
+         synchronous := mem_addr (16) = '0';
+      end if;
+      
+      if ram_ce = '1' then
+         ram_wait <= 'Z';
+         mem_data <= (others => 'Z');
+      elsif rising_edge(ram_clk) and synchronous then
+         if ram_adv = '0' then
+            addr := to_integer(unsigned(mem_addr (8 downto 1)));
+            writing := mem_we = '0';
+            latency := 3;
+            ram_wait <= '1';
+            mem_data <= (others => 'Z');
+         elsif latency > 0 then
+            latency := latency - 1;
+            if latency = 0 then
+               ram_wait <= '0';
+            end if;
+         else
+            addr := addr + 1;
+         end if;
+         
+         if ram_adv = '1' and latency = 0 then
+            if writing then
+               if ram_lb = '0' then
+                  ram(addr) (7 downto 0) := mem_data (7 downto 0);
+               end if;
+               if ram_ub = '0' then
+                  ram(addr) (15 downto 8) := mem_data (15 downto 8);
+               end if;
+            elsif mem_oe = '0' then
+               mem_data <= ram(addr);
+            end if;
+         end if;
+      end if;
+   end process;
+
    -- stimulus process
    stim_proc: process
    begin		
-      -- hold reset state for 100 ns.
-      wait for 100 ns;	
-
-      wait for clk_period*10;
-
-      -- insert stimulus here 
-
+      -- power up, then the bcr selects synchronous bursts of 4 words
+      wait until ram_cre = '1' for timeout;
+      assert ram_cre = '1' report "bcr not written" severity failure;
+      assert mem_addr (16) = '0' and mem_addr (3 downto 1) = "001" report "wrong bcr value" severity failure;
+      
+      -- the rom program stores #$af to $e0 (word $70, lower byte) ...
+      wait until mem_we = '0' and ram_cre = '0' for timeout;
+      wait for clk_period/4;
+      assert mem_we = '0' report "sta $e0 not executed" severity failure;
+      assert mem_addr (8 downto 1) = "01110000" report "sta to wrong address" severity failure;
+      assert ram_lb = '0' and ram_ub = '1' report "sta to wrong byte lane" severity failure;
+      assert mem_data (7 downto 0) = "10101111" report "sta wrote wrong value" severity failure;
+      
+      -- ... loads it back and copies "nop nop lda $f4 sta $e1" to $20,
+      -- which runs from ram through the cache and stores the miss count
+      loop
+         wait until mem_we = '0' and ram_cre = '0' for timeout;
+         wait for clk_period/4;
+         assert mem_we = '0' report "sta $e1 not executed" severity failure;
+         exit when mem_addr (8 downto 1) = "01110000" and ram_ub = '0';
+      end loop;
+      -- one miss for the line at $20, a second one if sta $25 hit the
+      -- line after it was filled
+      assert mem_data (15 downto 8) = "00000001" or mem_data (15 downto 8) = "00000010"
+         report "unexpected cache miss count" severity failure;
+      
+      -- then opcode $00 after the copied code stops the pipeline
+      wait until leds (7 downto 1) = "1111111" for timeout;
+      assert leds (7 downto 1) = "1111111" report "cpu did not reach end of rom" severity failure;
+      
+      -- the program never writes the uart at $d0-$df, the line stays idle
+      assert rs_tx = '1' report "uart transmitted without a send" severity failure;
+      
+      report "toplevel test done" severity note;
       wait;
    end process;
 
@@ -1,42 +1,266 @@
-----------------------------------------------------------------------------------
--- company: 
--- engineer: 
--- 
--- create date:    18:42:25 05/21/2013 
--- design name: 
--- module name:    uart - behavioral 
--- project name: 
--- target devices: 
--- tool versions: 
--- description: 
---
--- dependencies: 
---
--- revision: 
--- revision 0.01 - file created
--- additional comments: 
---
-----------------------------------------------------------------------------------
 library ieee;
 use ieee.std_logic_1164.all;
+use ieee.numeric_std.all;
 
--- uncomment the following library declaration if using
--- arithmetic functions with signed or unsigned values
---use ieee.numeric_std.all;
-
--- uncomment the following library declaration if instantiating
--- any xilinx primitives in this code.
---library unisim;
---use unisim.vcomponents.all;
-
+-- 8N1 uart with rx/tx fifos, registers at $FF00 0000 and $FF00 0003-$FF00
+-- 000F as described in doc/cpu.txt (the toy cpu in toplevel.vhd maps them
+-- at $D0-$DF), fifo_depth is at most 255
 entity uart is
-    port ( clk : in  std_logic );
+	generic ( fifo_depth : positive := 16 );
+	port ( clk : in  std_logic;
+	       -- register window, addr is the offset from $FF00 0000,
+	       -- rd/wr are single cycle strobes
+	       addr : in std_logic_vector (3 downto 0);
+	       rd : in std_logic;
+	       wr : in std_logic;
+	       wr_data : in std_logic_vector (7 downto 0);
+	       rd_data : out std_logic_vector (7 downto 0);
+	       irq : out std_logic;
+	       rx : in std_logic;
+	       tx : out std_logic );
 end uart;
 
 architecture behavioral of uart is
+	subtype byte_type is std_logic_vector (7 downto 0);
+	type fifo_type is array (0 to fifo_depth-1) of byte_type;
+
+	constant reg_fifo_depth : std_logic_vector (3 downto 0) := "0000";
+	constant reg_status : std_logic_vector (3 downto 0) := "0011";
+	constant reg_control : std_logic_vector (3 downto 0) := "0100";
+	constant reg_baudrate : std_logic_vector (3 downto 0) := "0101";
+	constant reg_send : std_logic_vector (3 downto 0) := "0110";
+	constant reg_recv : std_logic_vector (3 downto 0) := "0111";
+	constant reg_rx_level : std_logic_vector (3 downto 0) := "1000";
+	constant reg_tx_level : std_logic_vector (3 downto 0) := "1001";
+	constant reg_rx_threshold : std_logic_vector (3 downto 0) := "1110";
+	constant reg_tx_threshold : std_logic_vector (3 downto 0) := "1111";
+
+	signal control : byte_type := (others => '0');
+	signal baudrate : unsigned (7 downto 0) := to_unsigned(26, 8); -- 115200 baud at 50 MHz
+	signal rx_threshold : integer range 1 to 255 := 1;
+	signal tx_threshold : integer range 0 to 255 := 0;
+	signal err : std_logic := '0';
+	signal overrun : std_logic := '0';
+
+	signal rx_fifo : fifo_type;
+	signal rx_head : integer range 0 to fifo_depth-1 := 0;
+	signal rx_count : integer range 0 to fifo_depth := 0;
+	signal tx_fifo : fifo_type;
+	signal tx_head : integer range 0 to fifo_depth-1 := 0;
+	signal tx_count : integer range 0 to fifo_depth := 0;
+
+	-- 16 ticks per bit
+	signal baud_count : unsigned (7 downto 0) := (others => '0');
+	signal tick : std_logic := '0';
 
+	signal tx_busy : std_logic := '0';
+	signal tx_shift : std_logic_vector (9 downto 0) := (others => '1');
+	signal tx_bits : integer range 0 to 9 := 0;
+	signal tx_ticks : integer range 0 to 15 := 0;
+
+	type rx_state_type is (rx_idle, rx_start, rx_data, rx_stop);
+	signal rx_state : rx_state_type := rx_idle;
+	signal rx_sync : std_logic_vector (1 downto 0) := (others => '1');
+	signal rx_shift : byte_type := (others => '0');
+	signal rx_bits : integer range 0 to 7 := 0;
+	signal rx_ticks : integer range 0 to 15 := 0;
+	signal rx_done : std_logic := '0';
 begin
+	tx <= tx_shift (0);
 
+	irq <= '1' when (control (0) = '1' and rx_count >= rx_threshold) or
+	                (control (1) = '1' and tx_count <= tx_threshold) else '0';
 
-end behavioral;
+	registers_read : process(addr, overrun, err, tx_count, rx_count, rx_fifo, rx_head)
+	begin
+		rd_data <= (others => '0');
+		case addr is
+			when reg_status =>
+				rd_data (3) <= overrun;
+				rd_data (2) <= err;
+				if tx_count = 0 then
+					rd_data (1) <= '1';
+				end if;
+				if rx_count /= 0 then
+					rd_data (0) <= '1';
+				end if;
+			when reg_fifo_depth =>
+				rd_data <= std_logic_vector(to_unsigned(fifo_depth, 8));
+			when reg_recv =>
+				rd_data <= rx_fifo (rx_head);
+			when reg_rx_level =>
+				rd_data <= std_logic_vector(to_unsigned(rx_count, 8));
+			when reg_tx_level =>
+				rd_data <= std_logic_vector(to_unsigned(tx_count, 8));
+			when others =>
+				null;
+		end case;
+	end process;
+
+	baud : process(clk)
+	begin
+		if rising_edge(clk) then
+			if baud_count = baudrate then
+				baud_count <= (others => '0');
+				tick <= '1';
+			else
+				baud_count <= baud_count + 1;
+				tick <= '0';
+			end if;
+		end if;
+	end process;
+
+	receiver : process(clk)
+	begin
+		if rising_edge(clk) then
+			rx_sync <= rx_sync (0) & rx;
+			rx_done <= '0';
+
+			if tick = '1' then
+				case rx_state is
+					when rx_idle =>
+						if rx_sync (1) = '0' and control (2) = '1' then
+							rx_ticks <= 0;
+							rx_state <= rx_start;
+						end if;
 
+					-- sample the middle of the start bit, glitches go back to idle
+					when rx_start =>
+						if rx_ticks = 7 then
+							rx_ticks <= 0;
+							rx_bits <= 0;
+							if rx_sync (1) = '0' then
+								rx_state <= rx_data;
+							else
+								rx_state <= rx_idle;
+							end if;
+						else
+							rx_ticks <= rx_ticks + 1;
+						end if;
+
+					when rx_data =>
+						if rx_ticks = 15 then
+							rx_ticks <= 0;
+							rx_shift <= rx_sync (1) & rx_shift (7 downto 1);
+							if rx_bits = 7 then
+								rx_state <= rx_stop;
+							else
+								rx_bits <= rx_bits + 1;
+							end if;
+						else
+							rx_ticks <= rx_ticks + 1;
+						end if;
+
+					when rx_stop =>
+						if rx_ticks = 15 then
+							rx_ticks <= 0;
+							rx_done <= '1';
+							rx_state <= rx_idle;
+						else
+							rx_ticks <= rx_ticks + 1;
+						end if;
+				end case;
+			end if;
+		end if;
+	end process;
+
+	-- fifos, transmitter and register writes share the fifo state
+	control_proc : process(clk)
+		variable rx_n : integer range 0 to fifo_depth;
+		variable tx_n : integer range 0 to fifo_depth;
+		variable tx_h : integer range 0 to fifo_depth-1;
+	begin
+		if rising_edge(clk) then
+			rx_n := rx_count;
+			tx_n := tx_count;
+			tx_h := tx_head;
+
+			if rd = '1' and addr = reg_status then
+				err <= '0';
+				overrun <= '0';
+			end if;
+
+			-- receive: a stop bit of 0 is a framing error
+			if rx_done = '1' then
+				if rx_sync (1) = '0' then
+					err <= '1';
+				elsif rx_n = fifo_depth then
+					err <= '1';
+					overrun <= '1';
+				else
+					rx_fifo ((rx_head + rx_n) mod fifo_depth) <= rx_shift;
+					rx_n := rx_n + 1;
+				end if;
+			end if;
+
+			-- transmit: start bit, 8 data bits lsb first, stop bit
+			if tick = '1' then
+				if tx_busy = '1' then
+					if tx_ticks = 15 then
+						tx_ticks <= 0;
+						tx_shift <= '1' & tx_shift (9 downto 1);
+						if tx_bits = 9 then
+							tx_busy <= '0';
+						else
+							tx_bits <= tx_bits + 1;
+						end if;
+					else
+						tx_ticks <= tx_ticks + 1;
+					end if;
+				elsif tx_n /= 0 and control (3) = '1' then
+					tx_shift <= '1' & tx_fifo (tx_h) & '0';
+					tx_bits <= 0;
+					tx_ticks <= 0;
+					tx_busy <= '1';
+					tx_h := (tx_h + 1) mod fifo_depth;
+					tx_n := tx_n - 1;
+				end if;
+			end if;
+
+			if rd = '1' then
+				case addr is
+					when reg_recv =>
+						if rx_n /= 0 then
+							rx_head <= (rx_head + 1) mod fifo_depth;
+							rx_n := rx_n - 1;
+						end if;
+					when others =>
+						null;
+				end case;
+			end if;
+
+			if wr = '1' then
+				case addr is
+					when reg_control =>
+						control <= wr_data;
+					when reg_baudrate =>
+						baudrate <= unsigned(wr_data);
+					when reg_send =>
+						if control (3) = '0' then
+							null;
+						elsif tx_n = fifo_depth then
+							err <= '1';
+						else
+							tx_fifo ((tx_h + tx_n) mod fifo_depth) <= wr_data;
+							tx_n := tx_n + 1;
+						end if;
+					when reg_rx_threshold =>
+						if unsigned(wr_data) = 0 then
+							rx_threshold <= 1;
+						else
+							rx_threshold <= to_integer(unsigned(wr_data));
+						end if;
+					when reg_tx_threshold =>
+						tx_threshold <= to_integer(unsigned(wr_data));
+					when others =>
+						null;
+				end case;
+			end if;
+
+			rx_count <= rx_n;
+			tx_count <= tx_n;
+			tx_head <= tx_h;
+		end if;
+	end process;
+
+end behavioral;
@@ -0,0 +1,138 @@
+library ieee;
+use ieee.std_logic_1164.all;
+ 
+entity uart_test is
+end uart_test;
+ 
+architecture behavior of uart_test is 
+ 
+    -- component declaration for the unit under test (uut)
+ 
+    component uart
+	 generic ( fifo_depth : positive );
+    port(
+         clk : in  std_logic;
+         addr : in std_logic_vector (3 downto 0);
+         rd : in std_logic;
+         wr : in std_logic;
+         wr_data : in std_logic_vector (7 downto 0);
+         rd_data : out std_logic_vector (7 downto 0);
+         irq : out std_logic;
+         rx : in std_logic;
+         tx : out std_logic
+        );
+    end component;
+    
+
+   --inputs
+   signal clk : std_logic := '0';
+   signal addr : std_logic_vector (3 downto 0) := (others => '0');
+   signal rd : std_logic := '0';
+   signal wr : std_logic := '0';
+   signal wr_data : std_logic_vector (7 downto 0) := (others => '0');
+
+ 	--outputs
+   signal rd_data : std_logic_vector (7 downto 0);
+   signal irq : std_logic;
+   signal line : std_logic;
+
+   -- clock period definitions
+   constant clk_period : time := 10 ns;
+   -- baudrate register 0: one tick per clock, 160 clocks per byte
+   constant byte_time : time := clk_period * 16 * 10;
+begin
+ 
+	-- instantiate the unit under test (uut), tx looped back to rx
+   uut: uart
+		generic map ( fifo_depth => 4 )
+		port map (
+          clk => clk,
+          addr => addr,
+          rd => rd,
+          wr => wr,
+          wr_data => wr_data,
+          rd_data => rd_data,
+          irq => irq,
+          rx => line,
+          tx => line
+        );
+
+   -- clock process definitions
+   clk_process : process
+   begin
+		clk <= '0';
+		wait for clk_period/2;
+		clk <= '1';
+		wait for clk_period/2;
+   end process;
+
+   -- stimulus process
+   stim_proc: process
+      procedure write_reg (a : std_logic_vector (3 downto 0); d : std_logic_vector (7 downto 0)) is
+      begin
+         wait until clk = '0';
+         addr <= a;
+         wr_data <= d;
+         wr <= '1';
+         wait until clk = '0';
+         wr <= '0';
+      end procedure;
+      
+      procedure read_reg (a : std_logic_vector (3 downto 0); d : out std_logic_vector (7 downto 0)) is
+      begin
+         wait until clk = '0';
+         addr <= a;
+         wait for 1 ns;
+         d := rd_data;
+         rd <= '1';
+         wait until clk = '0';
+         rd <= '0';
+      end procedure;
+      
+      variable data : std_logic_vector (7 downto 0);
+   begin		
+      wait for 100 ns;
+      
+      write_reg ("0101", "00000000");  -- baudrate
+      write_reg ("1110", "00000011");  -- rx threshold 3
+      write_reg ("0100", "00001101");  -- rx/tx enable, rx interrupt
+      
+      -- three bytes go out through the tx fifo and come back into the rx fifo
+      write_reg ("0110", "01000001");
+      write_reg ("0110", "01000010");
+      write_reg ("0110", "01000011");
+      
+      wait for byte_time * 2;
+      assert irq = '0' report "irq below rx threshold" severity failure;
+      
+      wait until irq = '1' for byte_time * 3;
+      assert irq = '1' report "no irq at rx threshold" severity failure;
+      
+      read_reg ("1000", data);
+      assert data = "00000011" report "wrong rx level" severity failure;
+      read_reg ("0011", data);
+      assert data = "00000011" report "wrong status" severity failure;
+      
+      read_reg ("0111", data);
+      assert data = "01000001" report "wrong first byte" severity failure;
+      read_reg ("0111", data);
+      assert data = "01000010" report "wrong second byte" severity failure;
+      assert irq = '0' report "irq below rx threshold" severity failure;
+      read_reg ("0111", data);
+      assert data = "01000011" report "wrong third byte" severity failure;
+      
+      -- five bytes into a fifo of four: the last one overruns
+      for i in 0 to 4 loop
+         write_reg ("0110", "00110000");
+         wait for byte_time + clk_period * 20;
+      end loop;
+      read_reg ("0011", data);
+      assert data (3 downto 2) = "11" report "no over run" severity failure;
+      read_reg ("0011", data);
+      assert data (3 downto 2) = "00" report "errors not reset on read" severity failure;
+      
+      report "uart test done" severity note;
+      wait;
+   end process;
+
+end;